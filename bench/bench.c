@@ -0,0 +1,508 @@
+// bench.c: Benchmarks for curtkr's render and capture paths.
+// Build and run with: make bench && ./curtkr-bench
+//
+// Everything runs headless: the trail is drawn into a cairo image surface,
+// and the capture pipeline (capture_emit -> ring -> trail, logger and motion
+// analytics) is fed synthetic samples. Packed traces of the same samples
+// are decoded with each SIMD decoder. If $DISPLAY is set (e.g. under Xvfb),
+// the real XQueryPointer polling loop is measured as well (and with
+// HAVE_XCB, the pipelined XCB loop).
+
+#define CURTKR_NO_MAIN
+#include "../curtkr.c"
+
+#include <sched.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_FRAMES 2000       // Frames per render run (--frames)
+#define BENCH_SAMPLES 2000000   // Samples per pipeline run (--samples)
+#define BENCH_SECONDS 2.0       // Duration of the XQueryPointer run (--seconds)
+
+// --- Workloads ---
+
+enum {
+    WORKLOAD_IDLE,     // Pointer at rest
+    WORKLOAD_SWEEP,    // Linear sweeps across the screen, clicking now and then
+    WORKLOAD_TELEPORT, // xdotool-style jumps to random spots, then rest
+    WORKLOAD_JITTER,   // 1 kHz input device: small noisy steps, 16 per frame
+    WORKLOAD_COUNT
+};
+
+static const char *workload_names[WORKLOAD_COUNT] = { "idle", "sweep", "teleport", "jitter" };
+
+// Samples per 60 Hz frame: polling gives one, a 1 kHz mouse about 16
+static const int workload_rate[WORKLOAD_COUNT] = { 1, 1, 1, 16 };
+
+typedef struct {
+    int workload;
+    uint64_t n;        // Samples generated so far
+    uint32_t rng;
+    double x, y;
+} Trajectory;
+
+uint32_t xorshift32(uint32_t *state) {
+    uint32_t v = *state;
+    v ^= v << 13; v ^= v >> 17; v ^= v << 5;
+    return *state = v;
+}
+
+void trajectory_init(Trajectory *t, int workload) {
+    memset(t, 0, sizeof(*t));
+    t->workload = workload;
+    t->rng = 0x9e3779b9u;
+    t->x = BENCH_WIDTH / 2;
+    t->y = BENCH_HEIGHT / 2;
+}
+
+void trajectory_next(Trajectory *t, Sample *sample) {
+    unsigned int mask = 0;
+    switch (t->workload) {
+    case WORKLOAD_IDLE:
+        break;
+    case WORKLOAD_SWEEP: {
+        // 8 px per sample, one row of the screen per sweep
+        uint64_t per_row = BENCH_WIDTH / 8;
+        t->x = (double)(t->n % per_row) * 8;
+        t->y = (double)((t->n / per_row) * 40 % BENCH_HEIGHT);
+        if ((t->n / 50) % 4 == 0) mask = Button1Mask;
+        break;
+    }
+    case WORKLOAD_TELEPORT:
+        if (t->n % 8 == 0) {
+            t->x = xorshift32(&t->rng) % BENCH_WIDTH;
+            t->y = xorshift32(&t->rng) % BENCH_HEIGHT;
+        }
+        break;
+    case WORKLOAD_JITTER:
+        // Slow drift with +-2 px sensor noise
+        t->x += 0.25 + (double)(xorshift32(&t->rng) % 5) - 2;
+        t->y += (double)(xorshift32(&t->rng) % 5) - 2;
+        if (t->x < 0 || t->x >= BENCH_WIDTH) t->x = BENCH_WIDTH / 2;
+        if (t->y < 0 || t->y >= BENCH_HEIGHT) t->y = BENCH_HEIGHT / 2;
+        break;
+    }
+    sample->time_ns = now_ns(CLOCK_MONOTONIC);
+    sample->x = (int)t->x;
+    sample->y = (int)t->y;
+    sample->mask = mask;
+    sample->seat = 0;
+    sample->pointer = 0;
+    sample->child = None;
+    t->n++;
+}
+
+// --- Reporting ---
+
+void report(const char *what, const char *workload, unsigned int trail_length,
+            double seconds, unsigned long count, const char *unit, const Histogram *h) {
+    unsigned long total = atomic_load(&h->total);
+    printf("%-8s %-9s trail=%-7u %10.0f %s  p50=%8.1f p90=%8.1f p99=%8.1f max=%8.1f us\n",
+           what, workload, trail_length, count / seconds, unit,
+           hist_percentile(h, total, 0.50) / 1000.0, hist_percentile(h, total, 0.90) / 1000.0,
+           hist_percentile(h, total, 0.99) / 1000.0, atomic_load(&h->max) / 1000.0);
+}
+
+// --- Render: draw_trail into an image surface ---
+
+// Per frame: push that frame's samples, then draw and flush like the
+// cairo backend does. Latency is draw_trail + cairo_surface_flush.
+int bench_render(int workload, unsigned int trail_length, int frames) {
+    static Histogram frame_time;
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BENCH_WIDTH, BENCH_HEIGHT);
+    cairo_t *cr = cairo_create(surface);
+    SpriteAtlas sprites;
+    Trail trail;
+    Damage drawn = { .count = 0 };
+    Trajectory t;
+
+    if (cairo_status(cr) != CAIRO_STATUS_SUCCESS || sprites_create(&sprites, surface) != 0 ||
+        trail_init(&trail, trail_length) != 0) {
+        fprintf(stderr, "Error: Could not set up the render benchmark\n");
+        return -1;
+    }
+    memset(&frame_time, 0, sizeof(frame_time));
+    trajectory_init(&t, workload);
+
+    // Fill the trail first, so every frame draws a full-length trail
+    for (unsigned int i = 0; i < trail_length; ++i) {
+        Sample sample;
+        trajectory_next(&t, &sample);
+        trail_push(&trail, &sample);
+    }
+
+    unsigned long drawn_frames = 0;
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    for (int f = 0; f < frames; ++f) {
+        int redraw = 0;
+        for (int i = 0; i < workload_rate[workload]; ++i) {
+            Sample sample;
+            trajectory_next(&t, &sample);
+            redraw |= trail_push(&trail, &sample);
+        }
+        if (!redraw) continue; // The render loop would skip this frame too
+
+        uint64_t frame_ns = now_ns(CLOCK_MONOTONIC);
+        draw_trail(cr, &trail, &sprites, &drawn, 0, 0, BENCH_WIDTH, BENCH_HEIGHT);
+        cairo_surface_flush(surface);
+        hist_record(&frame_time, now_ns(CLOCK_MONOTONIC) - frame_ns);
+        drawn_frames++;
+    }
+    double seconds = (now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+
+    report("render", workload_names[workload], trail_length, seconds, drawn_frames, "frames/s ", &frame_time);
+
+    trail_free(&trail);
+    sprites_destroy(&sprites);
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+    return 0;
+}
+
+// --- Capture pipeline: capture_emit -> ring -> trail + logger + motion ---
+
+typedef struct {
+    CaptureContext *ctx;
+    int workload;
+    unsigned long samples;
+} Producer;
+
+void *producer_thread(void *arg) {
+    Producer *p = arg;
+    Trajectory t;
+    trajectory_init(&t, p->workload);
+    SampleRing *ring = p->ctx->ring;
+    for (unsigned long i = 0; i < p->samples; ++i) {
+        Sample sample;
+        // Unlike the real capture thread, wait for room instead of dropping:
+        // this measures how fast the render side can consume
+        while (atomic_load_explicit(&ring->head, memory_order_relaxed) -
+               atomic_load_explicit(&ring->tail, memory_order_acquire) == SAMPLE_RING_SIZE) {
+            sched_yield();
+        }
+        trajectory_next(&t, &sample);
+        capture_emit(p->ctx, &sample);
+    }
+    return NULL;
+}
+
+// The producer runs flat out, so this is the consumer's throughput; latency
+// is the sample's age when the render side takes it off a saturated ring.
+// Log lines go to /dev/null in CSV.
+int bench_pipeline(int workload, unsigned int trail_length, unsigned long samples) {
+    static SampleRing ring;
+    static Logger logger;
+    static Histogram queue_time;
+    static Motion motion;
+    CaptureContext ctx;
+    Trail trail;
+    Producer producer;
+    pthread_t tid;
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0 || ring_init(&ring) != 0 || trail_init(&trail, trail_length) != 0) {
+        fprintf(stderr, "Error: Could not set up the pipeline benchmark\n");
+        return -1;
+    }
+    memset(&queue_time, 0, sizeof(queue_time));
+    atomic_store(&ring.dropped, 0);
+    logger_init(&logger, null_fd, LOG_CSV);
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ring = &ring;
+    producer.ctx = &ctx;
+    producer.workload = workload;
+    producer.samples = samples;
+
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    if (pthread_create(&tid, NULL, producer_thread, &producer) != 0) {
+        fprintf(stderr, "Error: Could not start producer thread\n");
+        return -1;
+    }
+    unsigned long received = 0;
+    unsigned long dropped = 0;
+    while (received + dropped < samples) {
+        Sample sample;
+        int got = 0;
+        while (ring_pop(&ring, &sample)) {
+            hist_record(&queue_time, now_ns(CLOCK_MONOTONIC) - sample.time_ns);
+            logger_sample(&logger, &sample);
+            motion_push(&motion, &sample);
+            trail_push(&trail, &sample);
+            received++;
+            got = 1;
+        }
+        if (got) logger_batch_end(&logger);
+        dropped = atomic_load(&ring.dropped);
+        if (!got) ring_wait(&ring, -1, &(struct timespec){ 0, 1000000 }, NULL);
+    }
+    pthread_join(tid, NULL);
+    logger_flush(&logger);
+    double seconds = (now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+
+    report("pipeline", workload_names[workload], trail_length, seconds, received, "samples/s", &queue_time);
+    if (dropped) printf("         %lu samples dropped (ring full)\n", dropped);
+
+    trail_free(&trail);
+    close(ring.wake_fd);
+    close(null_fd);
+    return 0;
+}
+
+// --- Capture: XQueryPointer polling against a real (or Xvfb) server ---
+
+void bench_query_close(CaptureContext *ctx) {
+    if (ctx->display) XCloseDisplay(ctx->display);
+#ifdef HAVE_XCB
+    if (ctx->conn) xcb_disconnect(ctx->conn);
+#endif
+}
+
+// use_xcb: the pipelined XCB loop instead of Xlib's
+int bench_query(double seconds, int use_xcb) {
+    static SampleRing ring;
+    CaptureContext ctx;
+    pthread_t tid;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stop_fd = -1; // Stopped through keep_running; poll skips it (0 would be stdin)
+    ctx.display = XOpenDisplay(NULL);
+    if (!ctx.display) {
+        printf("query    skipped (no X display; run under xvfb-run for this one)\n");
+        return 0;
+    }
+    ctx.width = DisplayWidth(ctx.display, DefaultScreen(ctx.display));
+    ctx.height = DisplayHeight(ctx.display, DefaultScreen(ctx.display));
+#ifdef HAVE_XCB
+    if (use_xcb) {
+        XCloseDisplay(ctx.display);
+        ctx.display = NULL;
+        ctx.use_xcb = 1;
+        if (xcb_capture_init(&ctx, NULL, CAPTURE_POLL, 0) != 0) {
+            xcb_disconnect(ctx.conn);
+            return -1;
+        }
+    }
+#else
+    (void)use_xcb;
+#endif
+    ring_init(&ring);
+    if (ctx.display) ctx.root_window = DefaultRootWindow(ctx.display);
+    ctx.mode = CAPTURE_POLL;
+    ctx.fast_interval = 1; // As fast as round trips allow
+    ctx.idle_interval = 1;
+    ctx.ring = &ring;
+    memset(&stats.query_rtt, 0, sizeof(stats.query_rtt));
+
+    keep_running = 1;
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    if (pthread_create(&tid, NULL, capture_thread, &ctx) != 0) {
+        fprintf(stderr, "Error: Could not start capture thread\n");
+        bench_query_close(&ctx);
+        return -1;
+    }
+    uint64_t end_ns = start_ns + (uint64_t)(seconds * 1e9);
+    unsigned long received = 0;
+    while (now_ns(CLOCK_MONOTONIC) < end_ns) {
+        Sample sample;
+        while (ring_pop(&ring, &sample)) received++;
+        ring_wait(&ring, -1, &(struct timespec){ 0, 1000000 }, NULL);
+    }
+    keep_running = 0;
+    pthread_join(tid, NULL);
+    double elapsed = (now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+
+    report("query", use_xcb ? "xcb" : "poll", 0, elapsed, received, "samples/s", &stats.query_rtt);
+
+    bench_query_close(&ctx);
+    close(ring.wake_fd);
+    return 0;
+}
+
+// --- Decode: packed trace chunks back into records ---
+
+typedef size_t (*SvbDecoder)(const unsigned char *, size_t, uint32_t, uint32_t *, int);
+
+// The sample bench_decode writes as record 'i' of the trace
+void bench_decode_sample(Trajectory *t, unsigned long i, TraceRecord *record) {
+    Sample sample;
+    trajectory_next(t, &sample);
+    *record = (TraceRecord){ .time_ns = 1000000000ull + i * 1000000ull, .x = sample.x, .y = sample.y,
+                             .mask = sample.mask | (uint32_t)sample.pointer << MASK_POINTER_SHIFT,
+                             .child = (uint32_t)sample.child };
+}
+
+static inline int bench_record_equal(const TraceRecord *a, const TraceRecord *b) {
+    return a->time_ns == b->time_ns && a->x == b->x && a->y == b->y && a->mask == b->mask && a->child == b->child;
+}
+
+// Decode every chunk with 'decode' and compare each record with the scalar
+// decoder's and with the trajectory that was written. Returns 0 if all
+// match, -1 (after saying where) otherwise.
+int bench_decode_verify(TraceReader *tr, int workload, unsigned long samples, SvbDecoder decode, const char *name) {
+    static TraceRecord scalar[TRACE_PACKED_RECORDS];
+    Trajectory t;
+    trajectory_init(&t, workload);
+    unsigned long i = 0;
+    for (uint64_t k = 0; k < tr->chunks; ++k) {
+        const TraceRecord *records;
+        svb_decode = svb_decode_scalar;
+        unsigned int n = trace_reader_chunk(tr, k, &records);
+        memcpy(scalar, records, n * sizeof(TraceRecord));
+        svb_decode = decode;
+        unsigned int m = trace_reader_chunk(tr, k, &records);
+        if (m != n || n == 0) {
+            fprintf(stderr, "Error: %s decoder: chunk %lu has %u records, scalar %u\n", name, (unsigned long)k, m, n);
+            return -1;
+        }
+        for (unsigned int r = 0; r < n; ++r, ++i) {
+            TraceRecord written;
+            bench_decode_sample(&t, i, &written);
+            if (!bench_record_equal(&records[r], &scalar[r]) || !bench_record_equal(&records[r], &written)) {
+                fprintf(stderr, "Error: %s decoder: record %lu (chunk %lu) is %d,%d mask %#x at %lu, "
+                        "scalar %d,%d, written %d,%d mask %#x at %lu\n", name, i, (unsigned long)k,
+                        records[r].x, records[r].y, records[r].mask, (unsigned long)records[r].time_ns,
+                        scalar[r].x, scalar[r].y, written.x, written.y, written.mask, (unsigned long)written.time_ns);
+                return -1;
+            }
+        }
+    }
+    if (i != samples) {
+        fprintf(stderr, "Error: %s decoder: %lu records decoded, %lu written\n", name, i, samples);
+        return -1;
+    }
+    return 0;
+}
+
+// Record 'samples' samples of a workload (1 kHz timestamps) into a packed
+// trace, then decode every chunk with each decoder this CPU can run. Each
+// decoder's output is checked before it is timed. Latency is per chunk.
+int bench_decode(int workload, unsigned long samples) {
+    static TraceWriter tw;
+    static TraceReader tr;
+    char path[] = "/tmp/curtkr-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) { perror("mkstemp"); return -1; }
+    close(fd);
+
+    Trajectory t;
+    trajectory_init(&t, workload);
+    if (trace_open(&tw, path, BENCH_WIDTH, BENCH_HEIGHT, 1) != 0) { unlink(path); return -1; }
+    for (unsigned long i = 0; i < samples; ++i) {
+        Sample sample;
+        trajectory_next(&t, &sample);
+        sample.time_ns = 1000000000ull + i * 1000000ull;
+        trace_append(&tw, &sample);
+    }
+    trace_close(&tw);
+    int failed = trace_reader_open(&tr, path);
+    unlink(path);
+    if (failed) return -1;
+
+    const struct { const char *name; SvbDecoder decode; int ok; } decoders[] = {
+        { "scalar", svb_decode_scalar, 1 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "sse4.1", svb_decode_sse41, __builtin_cpu_supports("sse4.1") },
+        { "avx2", svb_decode_avx2, __builtin_cpu_supports("avx2") },
+#endif
+    };
+    SvbDecoder chosen = svb_decode;
+    for (size_t d = 0; d < sizeof(decoders) / sizeof(decoders[0]); ++d) {
+        static Histogram chunk_time;
+        if (!decoders[d].ok) continue;
+        if (bench_decode_verify(&tr, workload, samples, decoders[d].decode, decoders[d].name) != 0) {
+            failed = 1;
+            break;
+        }
+        svb_decode = decoders[d].decode;
+        memset(&chunk_time, 0, sizeof(chunk_time));
+        unsigned long decoded = 0;
+        uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+        for (int pass = 0; pass < 10; ++pass) {
+            for (uint64_t k = 0; k < tr.chunks; ++k) {
+                const TraceRecord *records;
+                uint64_t t0 = now_ns(CLOCK_MONOTONIC);
+                decoded += trace_reader_chunk(&tr, k, &records);
+                hist_record(&chunk_time, now_ns(CLOCK_MONOTONIC) - t0);
+            }
+        }
+        double elapsed = (now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+        unsigned long total = atomic_load(&chunk_time.total);
+        printf("%-8s %-9s %-6s %6.2f B/sample %10.0f samples/s  p50=%8.1f p99=%8.1f max=%8.1f us\n",
+               "decode", workload_names[workload], decoders[d].name, (double)tr.size / samples,
+               decoded / elapsed, hist_percentile(&chunk_time, total, 0.50) / 1000.0,
+               hist_percentile(&chunk_time, total, 0.99) / 1000.0, atomic_load(&chunk_time.max) / 1000.0);
+    }
+    svb_decode = chosen;
+    trace_reader_close(&tr);
+    return failed ? -1 : 0;
+}
+
+// --- Main ---
+
+void bench_usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -t, --trail LIST   Comma-separated trail lengths (default 50,1000,20000)\n"
+           "  -f, --frames N     Frames per render run (default %d)\n"
+           "  -s, --samples N    Samples per pipeline run (default %d)\n"
+           "  -d, --seconds S    Duration of the XQueryPointer run (default %.0f)\n"
+           "  -h, --help         Show this help\n", prog, BENCH_FRAMES, BENCH_SAMPLES, BENCH_SECONDS);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int trails[16] = { 50, 1000, 20000 };
+    int num_trails = 3;
+    int frames = BENCH_FRAMES;
+    unsigned long samples = BENCH_SAMPLES;
+    double seconds = BENCH_SECONDS;
+
+    static const struct option long_options[] = {
+        { "trail",   required_argument, NULL, 't' },
+        { "frames",  required_argument, NULL, 'f' },
+        { "samples", required_argument, NULL, 's' },
+        { "seconds", required_argument, NULL, 'd' },
+        { "help",    no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:f:s:d:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 't': {
+            num_trails = 0;
+            for (char *tok = strtok(optarg, ","); tok && num_trails < 16; tok = strtok(NULL, ",")) {
+                long n = atol(tok);
+                if (n < 1 || n > TRAIL_LENGTH_MAX) {
+                    fprintf(stderr, "Error: Trail length must be 1-%d\n", TRAIL_LENGTH_MAX); return 1;
+                }
+                trails[num_trails++] = (unsigned int)n;
+            }
+            break;
+        }
+        case 'f': frames = atoi(optarg); break;
+        case 's': samples = strtoul(optarg, NULL, 10); break;
+        case 'd': seconds = atof(optarg); break;
+        case 'h': bench_usage(argv[0]); return 0;
+        default:  bench_usage(argv[0]); return 1;
+        }
+    }
+    if (frames < 1 || samples < 1 || seconds <= 0 || num_trails == 0) {
+        bench_usage(argv[0]); return 1;
+    }
+
+    printf("%dx%d ARGB32 image surface, TRAIL_RADIUS %.1f\n", BENCH_WIDTH, BENCH_HEIGHT, TRAIL_RADIUS);
+    for (int w = 0; w < WORKLOAD_COUNT; ++w) {
+        for (int i = 0; i < num_trails; ++i) {
+            if (bench_render(w, trails[i], frames) != 0) return 1;
+        }
+    }
+    for (int w = 0; w < WORKLOAD_COUNT; ++w) {
+        if (bench_pipeline(w, trails[0], samples) != 0) return 1;
+    }
+    for (int w = 0; w < WORKLOAD_COUNT; ++w) {
+        if (bench_decode(w, samples) != 0) return 1;
+    }
+    if (bench_query(seconds, 0) != 0) return 1;
+#ifdef HAVE_XCB
+    if (bench_query(seconds, 1) != 0) return 1;
+#endif
+    return 0;
+}
@@ -1,26 +1,104 @@
 // curtkr.c: Tracks mouse, draws visual trail (red on click), prints coords.
-// Compile with: gcc curtkr.c -o curtkr -lX11 -lXfixes -lXext -lcairo -lm
+// Compile with: gcc curtkr.c -o curtkr -lX11 -lXfixes -lXext -lXi -lXrandr -lcairo -lm -pthread
+//           (or just `make`; `make bench` builds the benchmarks in bench/)
+// Optional: add -DHAVE_XPRESENT -lXpresent to present frames in sync with vblank
+//           add -DHAVE_EGL -lEGL -lGLESv2 for the GPU renderer (--renderer egl)
+//           add -DHAVE_LZ4 -llz4 and/or -DHAVE_ZSTD -lzstd to compress --send frames
+//           add -DHAVE_XCB -lxcb -lxcb-xinput for pipelined capture (--xcb)
 
+#define _GNU_SOURCE     // For ppoll
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>     // For usleep
+#include <stdarg.h>
+#include <unistd.h>     // For write, close, isatty
 #include <signal.h>     // For signal handling (Ctrl+C)
 #include <string.h>     // For memset
 #include <math.h>       // For fade calculation (optional)
+#include <errno.h>
+#include <limits.h>     // PATH_MAX
+#include <getopt.h>     // For command line options
+#include <sys/select.h> // For pselect in the event-driven loop
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>  // For the lock-free sample ring
+#include <pthread.h>    // Capture runs on its own thread
+#include <poll.h>
+#include <sys/epoll.h>    // The render thread's event loop
+#include <sys/signalfd.h> // Signals are read as events, not handled asynchronously
+#include <sys/timerfd.h>  // Log flush deadline
+#include <sys/eventfd.h> // Wakes the sleeping thread on the other side of the ring
+#include <sys/mman.h>   // Trace files are written through mmap
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h> // Stats endpoint (--stats-socket)
+#include <sys/un.h>
+#include <netdb.h>      // Network export (--send)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/shape.h> // Needed for ShapeInput
+#include <X11/extensions/XInput2.h> // For raw motion/button capture
+#include <X11/extensions/XI.h>      // XI_BadDevice
+#include <X11/extensions/Xrandr.h>  // One overlay per monitor
+#include <X11/extensions/XShm.h>    // Shared-memory uploads (--renderer xshm)
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#ifdef HAVE_XPRESENT
+#include <X11/extensions/Xpresent.h> // For vblank-synced presentation
+#endif
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-xlib.h>
 
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_XCB
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h> // xcb_poll_for_reply: take a reply only if it is already in
+#include <xcb/xinput.h>
+#endif
+
 // --- Configuration ---
-#define TRAIL_LENGTH 50      // Number of points in the trail
+#define TRAIL_LENGTH 50      // Default number of points in the trail (--trail)
+#define TRAIL_LENGTH_MAX (1 << 22)
 #define TRAIL_RADIUS 3.0     // Radius of the circles in the trail
+// Dots closer than this (px) to a newer dot of the same color are not drawn
+#define TRAIL_COALESCE_DIST 1.5
+// --interpolate: a gap between points wider than TRAIL_INTERP_SPACING (px) is
+// filled in, with up to TRAIL_INTERP_STEPS - 1 dots. Gaps wider than
+// TRAIL_INTERP_MAX_DIST are jumps (warps, another monitor) and stay open.
+#define TRAIL_INTERP_SPACING 3.0
+#define TRAIL_INTERP_STEPS 32
+#define TRAIL_INTERP_MAX_DIST 512.0
+// --predict: the trail head is drawn where the pointer will be PREDICT_LEAD_MS
+// after the frame is drawn (about when it reaches the screen), never more
+// than PREDICT_MAX_MS past the newest sample. Once no sample has come for two
+// sample intervals (at least PREDICT_HOLD_MIN_MS), the pointer has stopped
+// and the head goes back to the newest sample.
+#define PREDICT_LEAD_MS 16
+#define PREDICT_MAX_MS 50
+#define PREDICT_HOLD_MIN_MS 8
+#define PREDICT_MAX_PX 256    // A prediction further ahead than this is a jump, not drawn
+#define PREDICT_HISTORY 32    // linear: samples kept for the velocity fit (a power of two)...
+#define PREDICT_WINDOW_MS 24  // ... over this long
+#define PREDICT_ALPHA 0.6     // kalman: alpha-beta filter gains (critically damped)
+#define PREDICT_BETA 0.26
 #define UPDATE_INTERVAL 16666 // Microseconds (16666 approx = 60 FPS)
+// Adaptive polling (--idle-rate): each idle sample stretches the interval by
+// this factor, from the --rate interval up to the --idle-rate interval
+#define ADAPT_BACKOFF 1.1
 // Trail Color (Red, Green, Blue - values 0.0 to 1.0)
 #define TRAIL_R 0.2
 #define TRAIL_G 0.5
@@ -29,233 +107,5982 @@
 #define CLICK_R 1.0
 #define CLICK_G 0.0
 #define CLICK_B 0.0
+// Alpha levels pre-rendered per color in the sprite atlas
+#define SPRITE_LEVELS 64
+// Stats histograms: 2^HIST_SUB_BITS buckets per power of two (values to ~6%)
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define STATS_REPORT_SIZE 16384
+
+#define MOTION_WINDOW_MS 1000 // Rolling window of the live motion metrics
+#define MOTION_SLICES 10      // ... kept as this many time slices
+#define MOTION_MIN_DT_MS 4    // Shortest span speed is estimated over
+// Overlay windows (one per RandR monitor)
+#define OVERLAY_MAX_MONITORS 16
+// Present: draw again anyway if a frame's events haven't come after this long
+#define PRESENT_TIMEOUT_MS 100
+// XI2 capture: re-read the absolute pointer position after this much input silence
+#define XI2_RESYNC_MS 50
+#define XI2_MAX_DEVICES 64
+// --xcb polling: most pointer queries waiting for their replies at once
+// (at least POINTER_MAX). A tick that would go over is skipped and counted
+// as a missed deadline, so a slow server sheds ticks instead of a backlog
+// building up.
+#define XCB_QUERIES_IN_FLIGHT 64
+
+#define SEAT_MAX 8           // X displays followed at once (--display)
+#define POINTER_MAX 16       // Master pointers followed per display (--all-pointers)
+// Capture -> render queue depth, must be a power of two
+#define SAMPLE_RING_SIZE 4096
+// Logger: buffered output is written out when it reaches LOG_BUFFER_SIZE or is
+// LOG_FLUSH_MS old, whichever comes first
+#define LOG_BUFFER_SIZE (256 * 1024)
+#define LOG_FLUSH_MS 100
+// Longest line logger_printf must be able to fit without splitting it
+#define LOG_LINE_MAX 2048
+// Window attribution (--windows): cached windows (a power of two) and
+// longest WM_CLASS / title kept, in bytes
+#define WINDOW_CACHE_SIZE 1024
+#define WINDOW_CLASS_MAX 64
+#define WINDOW_TITLE_MAX 128
+#define WINDOW_FIELD_MAX 1536 // Both, escaped for JSON at worst (6 bytes per byte)
+// Trace recording: chunks mapped at a time (each chunk is TRACE_CHUNK_SIZE bytes)
+#define TRACE_MAP_CHUNKS 256
+// Triggered recording (--trigger): default seconds kept before a trigger
+// and recorded after it, and the default 'jump' distance (px). The pre-roll
+// ring holds --pre-roll seconds at up to TRIGGER_RATE_MAX samples/s; beyond
+// that the start of the pre-roll is lost.
+#define TRIGGER_PRE_ROLL 5.0
+#define TRIGGER_POST_ROLL 5.0
+#define TRIGGER_JUMP_PX 200
+#define TRIGGER_RATE_MAX 2000
+// Shared-memory sample ring (--shm), must be a power of two
+#define SHM_RING_SIZE 65536
+// Trace replay: chunks (TRACE_CHUNK_SIZE) prefetched ahead of the one playing
+#define REPLAY_READAHEAD_CHUNKS 64
+// Network export (--send): a frame goes out once its body reaches
+// NET_BODY_TCP / NET_BODY_UDP bytes (UDP: one datagram, well under a 1500
+// byte MTU) or is NET_FLUSH_MS old. Up to NET_QUEUE_FRAMES (a power of two)
+// wait for the sender thread.
+#define NET_BODY_TCP 16384
+#define NET_BODY_UDP 1200
+#define NET_FLUSH_MS 50
+#define NET_QUEUE_FRAMES 64
+#define NET_CONNECT_MS 2000      // TCP connect and send timeout
+#define NET_RETRY_MS 250         // Reconnect backoff, doubling up to NET_RETRY_MAX_MS
+#define NET_RETRY_MAX_MS 8000
+#define NET_ZSTD_LEVEL 1
+// Heatmap (--heatmap): grid cells are grouped into tiles of HEATMAP_TILE x
+// HEATMAP_TILE, the unit of recoloring and uploading. A press counts as
+// HEATMAP_CLICK_WEIGHT moves.
+#define HEATMAP_CELL 4           // Default screen pixels per cell, each way
+#define HEATMAP_TILE 64
+#define HEATMAP_CLICK_WEIGHT 32
+#define HEATMAP_ALPHA 0.6        // Opacity of the hottest cells
+// Dirty rectangles tracked per frame before they collapse into one bounding box
+#define DAMAGE_MAX_RECTS 128
 // --- End Configuration ---
 
-// Structure to hold a point
+// Any of Button1Mask to Button5Mask
+#define BUTTON_MASK_ANY (Button1Mask | Button2Mask | Button3Mask | Button4Mask | Button5Mask)
+
+// Trail point flags
+#define TRAIL_VALID   0x01 // Slot contains actual data
+#define TRAIL_CLICKED 0x02 // Mouse button was pressed
+
+// Trail points (circular buffer), owned by the render thread. Stored as
+// separate arrays of packed coordinates and flags (5 bytes a point) so a
+// walk over even a very long trail stays in cache. The capacity is a power
+// of two, so slots are found with '& mask' rather than '%'.
+typedef struct {
+    int16_t *x;
+    int16_t *y;
+    uint8_t *flags;        // TRAIL_* bits
+    unsigned int mask;     // Capacity - 1
+    unsigned int length;   // Points drawn, oldest fading out (<= capacity)
+    unsigned int head;     // Index of the next spot to write to (free-running)
+    unsigned int unchanged; // Consecutive pushes identical to the previous point
+    int interpolate;       // Fill gaps between points (--interpolate)
+    int lead;              // Predicted head (--predict) drawn at lead_x, lead_y
+    int16_t lead_x, lead_y;
+} Trail;
+
+enum { PREDICT_NONE, PREDICT_LINEAR, PREDICT_KALMAN };
+
+// Motion prediction for one pointer (--predict), owned by the render thread.
+// Velocity is estimated in sample time; the extrapolation runs from when the
+// newest sample reached the render thread, so a replay predicts the same way
+// as live capture.
+typedef struct {
+    int model;           // PREDICT_*
+    unsigned int count;  // Samples in the history (up to PREDICT_HISTORY)
+    unsigned int head;   // Next history slot
+    uint64_t time_ns[PREDICT_HISTORY];
+    int x[PREDICT_HISTORY], y[PREDICT_HISTORY];
+    double px, py;       // kalman: filtered position...
+    double vx, vy;       // ... and velocity, px/ns
+    double interval_ns;  // Smoothed time between samples
+    uint64_t arrived_ns; // When the newest sample was popped from the ring
+} Predictor;
+
+// Screen area touched by a frame, as half-open rectangles [x1,x2) x [y1,y2)
+typedef struct {
+    int x1, y1, x2, y2;
+} DirtyRect;
+
+typedef struct {
+    DirtyRect rects[DAMAGE_MAX_RECTS];
+    int count;
+} Damage;
+
+// Pre-rendered trail dots: row 0 in the trail color, row 1 in the click
+// color, one column per alpha level (column SPRITE_LEVELS - 1 is opaque).
+// Drawing a dot is then a blit instead of building and filling an arc.
+typedef struct {
+    cairo_surface_t *surface;
+    int extent; // Distance from a sprite's top-left corner to the dot centre
+    int cell;   // Width and height of one sprite (2 * extent)
+} SpriteAtlas;
+
 typedef struct {
+    int seen, x, y;
+    unsigned int mask;
+} HeatmapPointer;
+
+// Session-long density of pointer moves and clicks over one display, owned
+// by the render thread. A sample costs one increment and recolors its cell
+// in 'image' (one pixel per cell); only the tiles that changed are then
+// uploaded to the heatmap overlays. Colors are on a log scale up to
+// 'scale', which doubles when a cell outgrows it, so a full recolor happens
+// only a few dozen times in a session.
+typedef struct {
+    int cell;                    // Screen pixels per cell, each way
+    int width, height;           // Grid size, in cells
+    int tiles_x, tiles_y;
+    uint32_t *counts;            // width * height
+    uint32_t max;                // Highest count
+    uint32_t scale;              // Count shown in the hottest color, a power of two
+    float inv_log_scale;         // 1 / log2(1 + scale)
+    cairo_surface_t *image;      // ARGB32, width x height
+    uint32_t *pixels;            // ... its data
+    int stride;                  // ... in pixels
+    uint8_t *tile_dirty;         // Per tile: changed since last drawn
+    int *dirty;                  // ... as a list
+    int ndirty;
+    uint32_t colors[256];        // Log-scaled level -> premultiplied ARGB
+    int screen_width, screen_height;
+    HeatmapPointer last[POINTER_MAX]; // Previous sample of each pointer
+} Heatmap;
+
+// One pointer reading, as taken by the capture thread
+typedef struct {
+    uint64_t time_ns;  // CLOCK_MONOTONIC when the sample was taken
     int x;
     int y;
-    int valid;   // Flag to indicate if this point contains actual data
-    int clicked; // <<<< NEW: Flag to indicate if mouse button was pressed
-} TrailPoint;
+    unsigned int mask; // Button state, core Button*Mask bits
+    uint16_t seat;     // Display it was taken on (index of --display)
+    uint16_t pointer;  // Master pointer on that display (0 unless --all-pointers)
+    Window child;      // Child of the root the pointer is over (None if unknown)
+} Sample;
+
+// --- Trace File Format ---
+// A trace is a TraceHeader page followed by fixed-size chunks. Each chunk
+// starts with a TraceIndexBlock and holds up to TRACE_CHUNK_RECORDS records.
+// Since chunk k always lives at header_size + k * chunk_size, readers can
+// binary-search the index blocks by time without scanning the records.
+// All fields are little-endian (host order on every platform we run on).
+//
+// Packed traces (--packed, TRACE_ENCODING_PACKED) use the same chunks and
+// index blocks, so seeking works the same, but each chunk holds up to
+// TRACE_PACKED_RECORDS records (the header's records_per_chunk) as columns: three Stream VByte streams of
+// zigzag deltas (low 32 bits of time_ns, then x, then y; the first record's
+// deltas are from first_time_ns, 0 and 0), then, from the next 8-byte
+// boundary, index->events TraceEvents for the rare records whose mask or
+// child changes or whose time delta needs more than 32 bits. A stream of n
+// values is (n + 3) / 4 control bytes, two bits per value (its length in
+// bytes - 1, value i in bits 2 * (i % 4) of byte i / 4), then each value's
+// low bytes, little-endian. That is 4-6 bytes a record instead of 24.
+#define TRACE_MAGIC "CURTKRTR"
+#define TRACE_VERSION 1          // Raw traces; readable by every version
+#define TRACE_VERSION_ENCODING 2 // Adds TraceHeader.encoding (packed traces)
+#define TRACE_HEADER_SIZE 4096
+#define TRACE_CHUNK_SIZE 65536
+#define TRACE_INDEX_MAGIC 0x58444954u // "TIDX"
+
+typedef struct {
+    char magic[8];               // TRACE_MAGIC
+    uint32_t version;            // TRACE_VERSION
+    uint32_t header_size;        // Offset of chunk 0
+    uint32_t chunk_size;         // Bytes per chunk, index block included
+    uint32_t record_size;        // sizeof(TraceRecord)
+    uint32_t records_per_chunk;  // Most records a chunk holds (TRACE_CHUNK_RECORDS, packed: TRACE_PACKED_RECORDS)
+    int32_t screen_width;
+    int32_t screen_height;
+    uint32_t encoding;           // TRACE_ENCODING_* (version 2; always raw in version 1)
+    uint64_t start_monotonic_ns; // CLOCK_MONOTONIC at start of recording
+    uint64_t start_realtime_ns;  // CLOCK_REALTIME at the same instant
+    uint64_t chunk_count;        // Chunks started so far
+    uint64_t record_count;       // Records written so far
+} TraceHeader;
+
+typedef struct {
+    uint32_t magic;              // TRACE_INDEX_MAGIC
+    uint32_t count;              // Records used in this chunk
+    uint64_t chunk;              // Chunk number
+    uint64_t first_record;       // Sequence number of the chunk's first record
+    uint64_t first_time_ns;      // Timestamp of the first record
+    uint64_t last_time_ns;       // Timestamp of the last record
+    uint32_t stream_size[3];     // Packed: bytes in the time, x and y streams
+    uint32_t events;             // Packed: TraceEvents after the streams
+    uint8_t reserved[8];
+} TraceIndexBlock;
+
+typedef struct {
+    uint64_t time_ns;            // CLOCK_MONOTONIC
+    int32_t x;
+    int32_t y;
+    uint32_t mask;               // XQueryPointer mask_return, pointer in the top byte
+    uint32_t child;              // XQueryPointer child_return
+} TraceRecord;
+
+enum { TRACE_ENCODING_RAW = 0, TRACE_ENCODING_PACKED = 1 };
+
+// Packed chunks: a change that the delta streams don't carry
+typedef struct {
+    uint32_t record;             // Index within the chunk; events are in ascending order
+    uint32_t field;              // TRACE_EVENT_*
+    uint64_t value;
+} TraceEvent;
+
+enum {
+    TRACE_EVENT_MASK = 0,        // value: the record's mask (and older ones until the next event)
+    TRACE_EVENT_CHILD = 1,       // value: the record's child, likewise
+    TRACE_EVENT_TIME_HIGH = 2,   // value: high 32 bits of the record's zigzag time delta
+};
+
+// Core masks only use the low 16 bits, so trace records and shm slots keep
+// Sample.pointer in mask's top byte; older traces read back as pointer 0.
+#define MASK_POINTER_SHIFT 24
 
-// Global array for trail points (circular buffer)
-TrailPoint trail_points[TRAIL_LENGTH];
-int trail_head = 0; // Index of the next spot to write to
+#define TRACE_CHUNK_RECORDS ((TRACE_CHUNK_SIZE - sizeof(TraceIndexBlock)) / sizeof(TraceRecord))
+// Packed records per chunk: the least a record can take is 3.75 bytes
+#define TRACE_PACKED_RECORDS 16384
+
+_Static_assert(sizeof(TraceHeader) <= TRACE_HEADER_SIZE, "trace header too large");
+_Static_assert(sizeof(TraceIndexBlock) == 64, "trace index block must stay 64 bytes");
+_Static_assert(sizeof(TraceRecord) == 24, "trace record must stay 24 bytes");
+_Static_assert(sizeof(TraceEvent) == 16, "trace event must stay 16 bytes");
+
+// Append-only writer. Only the current window of chunks is mapped; it is
+// remapped every TRACE_MAP_CHUNKS chunks, so a record costs a memory store
+// and the syscalls are amortized over hundreds of thousands of samples.
+typedef struct {
+    int fd;
+    TraceHeader *header;         // Mapped header page
+    unsigned char *window;       // Mapped chunks [window_first, window_first + TRACE_MAP_CHUNKS)
+    uint64_t window_first;
+    TraceIndexBlock *index;      // Index block of the current chunk
+    TraceRecord *records;        // Records of the current chunk
+    // Packed traces: records wait here until their chunk is full
+    int packed;
+    TraceRecord *pending;        // TRACE_PACKED_RECORDS
+    unsigned int pending_count;
+    unsigned int pending_events;
+    size_t pending_size;         // Bytes they will take in the chunk, index block included
+    uint32_t *columns;           // Encoding scratch, 3 * TRACE_PACKED_RECORDS
+    size_t chunk_used;           // Bytes used in the current (already packed) chunk
+} TraceWriter;
+
+// Trigger kinds (--trigger), bits
+enum {
+    TRIGGER_CLICK  = 1, // A button going down
+    TRIGGER_JUMP   = 2, // A pointer moving more than jump_px between two samples
+    TRIGGER_SIGNAL = 4, // SIGUSR2
+};
+
+// Triggered recording, owned by the capture thread except for the signal
+// fields.
+// Samples wait in a ring (circular buffer, power of two like Trail) instead
+// of going to the trace. A trigger writes out the last pre_roll_ns of it,
+// then records straight through until post_roll_ns after the latest
+// trigger, so the trace only grows around the moments that matter.
+typedef struct {
+    int triggers;              // TRIGGER_* bits
+    double jump_px;
+    uint64_t pre_roll_ns, post_roll_ns;
+    Sample *ring;
+    uint64_t mask;             // Capacity - 1
+    uint64_t head, tail;       // Free-running; [tail, head) not written out yet
+    int recording;             // Writing straight through...
+    uint64_t until_ns;         // ... up to this sample time
+    Sample last[POINTER_MAX];  // Previous sample of each pointer
+    uint32_t have_last;        // ... bit per pointer
+    _Atomic uint64_t signalled_ns; // Render thread: when SIGUSR2 came in, 0 if handled
+    int wake_fd;               // eventfd (TRIGGER_SIGNAL only, else -1): wakes the capture loop
+} TriggerRecorder;
+
+// Read-only view of a whole trace file, for replay
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t size;
+    const TraceHeader *header;
+    uint64_t chunks;             // Chunks actually present in the file
+    TraceRecord *unpacked;       // Packed traces: the chunk last decoded
+    uint32_t *columns;           // ... and decoding scratch
+} TraceReader;
+
+// Live samples published to POSIX shared memory (--shm NAME) for other
+// local processes. A header page is followed by SHM_RING_SIZE slots, each
+// guarded by its own sequence number (a per-slot seqlock): sample i goes to
+// slot i & (capacity - 1), whose seq is 2i + 1 while it is being written and
+// 2i + 2 once it is complete. To read sample i, load seq (acquire), copy the
+// slot, fence (acquire) and load seq again; the copy is good if both loads
+// were 2i + 2. Anything else means it was torn or already overwritten.
+// head is the number of samples published; the newest is head - 1.
+#define SHM_MAGIC "CURTKRSM"
+#define SHM_VERSION 1
+
+typedef struct {
+    char magic[8];               // SHM_MAGIC
+    uint32_t version;            // SHM_VERSION
+    uint32_t header_size;        // Offset of slot 0
+    uint32_t slot_size;          // sizeof(ShmSlot)
+    uint32_t capacity;           // Slots, a power of two
+    int32_t pid;                 // Publishing process
+    int32_t screen_width;
+    int32_t screen_height;
+    uint32_t reserved0;
+    _Alignas(64) _Atomic uint64_t head; // Samples published so far
+} ShmHeader;
+
+typedef struct {
+    _Atomic uint64_t seq;        // 2i + 1 while sample i is written, 2i + 2 when done
+    uint64_t time_ns;            // CLOCK_MONOTONIC
+    int32_t x;
+    int32_t y;
+    uint32_t mask;               // XQueryPointer mask_return, pointer in the top byte
+    uint32_t child;              // XQueryPointer child_return
+} ShmSlot;
+
+_Static_assert(sizeof(ShmHeader) <= 4096, "shm header too large");
+_Static_assert(sizeof(ShmSlot) == 32, "shm slot must stay 32 bytes");
+
+typedef struct {
+    const char *name;            // shm_open name, unlinked on close
+    void *map;
+    size_t size;
+    ShmHeader *header;
+    ShmSlot *slots;
+    uint64_t head;               // Private copy of header->head (single writer)
+} ShmPublisher;
+
+// --- Network Frame Format ---
+// --send streams samples in frames. Each frame is self-contained, so a lost
+// UDP datagram (or a TCP reconnect) only loses the samples in it:
+//   u32 length       Bytes after this field (little-endian)
+//   u8 version       NET_VERSION
+//   u8 codec         NET_CODEC_*, how the body is compressed
+//   varint first     Index of the frame's first sample since start; a gap
+//                    after the previous frame's first + count is samples lost
+//   varint count     Samples in the frame
+//   varint raw_size  Body size before compression
+//   body
+// The uncompressed body is the first sample's time_ns, then per sample:
+//   u8 fields        NET_FIELD_* bits: which of the optional values follow
+//   varint dt        time_ns - previous time_ns, zigzag
+//   varint dx, dy    x - previous x, y - previous y, zigzag (NET_FIELD_X, NET_FIELD_Y)
+//   varint mask      mask ^ previous mask                   (NET_FIELD_MASK)
+//   varint source    (seat << 8 | pointer) ^ previous       (NET_FIELD_SOURCE)
+//   varint child     child ^ previous child                 (NET_FIELD_CHILD)
+// "Previous" starts out as the first time_ns and zero for everything else.
+// Varints are LEB128 (7 bits a byte, least significant first); zigzag maps
+// n to (n << 1) ^ (n >> 63). A resting pointer costs about 5 bytes a sample,
+// a moving one 6-7.
+#define NET_VERSION 1
+enum { NET_CODEC_NONE = 0, NET_CODEC_LZ4 = 1, NET_CODEC_ZSTD = 2 };
+enum {
+    NET_FIELD_X      = 0x01,
+    NET_FIELD_Y      = 0x02,
+    NET_FIELD_MASK   = 0x04,
+    NET_FIELD_SOURCE = 0x08,
+    NET_FIELD_CHILD  = 0x10,
+};
+#define NET_SAMPLE_MAX 48        // Longest encoded sample
+#define NET_HEADER_MAX 36        // length, version, codec and three varints
+
+// A frame being filled (render thread) or waiting to be sent (sender thread)
+typedef struct {
+    uint64_t first;              // Index of the first sample
+    unsigned int count;
+    size_t size;                 // Body bytes
+    unsigned char body[NET_BODY_TCP];
+} NetFrame;
+
+// Network sink (--send). The render thread encodes samples straight into
+// the head slot of a bounded SPSC queue of frames, and a sender thread
+// compresses and sends them. The render thread never waits: while the
+// sender is behind or reconnecting and the queue is full, samples are
+// dropped and counted instead.
+typedef struct {
+    const char *url;
+    int udp;
+    struct sockaddr_storage addr; // Resolved once, at start
+    socklen_t addr_len;
+    int codec;                   // NET_CODEC_*
+    size_t body_limit;           // Frames are sent once their body gets this large
+    NetFrame *frames;            // NET_QUEUE_FRAMES slots
+    _Alignas(64) atomic_uint head; // Written by the render thread only
+    _Alignas(64) atomic_uint tail; // Written by the sender thread only
+    atomic_int stopping;
+    int wake_fd;                 // eventfd: frame queued or stopping
+    pthread_t tid;
+    int started;
+    // Render thread
+    NetFrame *frame;             // Frame being filled, NULL if none
+    uint64_t next;               // Index of the next sample, sent or not
+    uint64_t started_ns;         // When the frame being filled got its first sample
+    Sample prev;
+    // Sender thread
+    int fd;                      // -1 while disconnected
+    int warned;                  // Connection problem reported, until reconnected
+    unsigned char out[NET_HEADER_MAX + NET_BODY_TCP];
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} NetSink;
+
+// Single-producer/single-consumer queue from the capture thread to the
+// render thread. head and tail only ever increase; the slot is index & mask.
+// The producer never blocks: when the queue is full the sample is dropped.
+typedef struct {
+    Sample slots[SAMPLE_RING_SIZE];
+    _Alignas(64) atomic_uint head;     // Written by the producer only
+    _Alignas(64) atomic_uint tail;     // Written by the consumer only
+    _Alignas(64) atomic_int consumer_waiting; // Consumer is (about to be) asleep on wake_fd
+    atomic_ulong dropped;              // Samples lost to a full queue
+    int wake_fd;                       // eventfd, written only when the consumer sleeps
+} SampleRing;
 
 // Global flag to control the main loop
 volatile sig_atomic_t keep_running = 1;
 
-// Signal handler for SIGINT (Ctrl+C)
-void handle_sigint(int sig) {
-    printf("\nCaught signal %d. Exiting gracefully...\n", sig);
-    keep_running = 0;
-}
+// Log-linear (HDR-style) histogram of nanosecond durations. Buckets are
+// relaxed atomics, so any thread can record and any thread can read a
+// (slightly torn, but never corrupt) snapshot without locking.
+typedef struct {
+    atomic_ulong counts[HIST_BUCKETS];
+    atomic_ulong total;
+    atomic_ulong sum;
+    atomic_ulong max;
+} Histogram;
 
-// Function to draw the trail onto the Cairo surface
-void draw_trail(cairo_t *cr, int width, int height) {
-    // 1. Clear the entire surface to fully transparent
-    cairo_set_source_rgba(cr, 0, 0, 0, 0);
-    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-    cairo_paint(cr);
-    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+// Motion in one slice of the rolling window
+typedef struct {
+    double distance;       // Path length, px
+    double peak_speed;     // px/s
+    double peak_accel;     // |d speed / dt|, px/s^2
+    double peak_jerk;      // |d accel / dt|, px/s^3
+    unsigned long presses; // Button press edges
+} MotionSlice;
+
+// One pointer's motion as shown in the stats report
+typedef struct {
+    uint64_t time_ns;      // Newest sample; the window ends here
+    double speed, accel;   // Latest estimates
+    MotionSlice window;    // Distance and presses summed, peaks maxed over the window
+    double distance;       // Since start
+    unsigned long presses; // Since start
+    unsigned int held;     // Buttons down, core Button*Mask bits
+} MotionSummary;
 
-    // 2. Draw the trail points
-    for (int i = 0; i < TRAIL_LENGTH; ++i) {
-        int current_index = (trail_head - 1 - i + TRAIL_LENGTH) % TRAIL_LENGTH;
+// Streaming motion analytics for one pointer, owned by the render thread
+// and O(1) per sample. Speed and its derivatives are finite differences over
+// spans of at least MOTION_MIN_DT_MS, so XI2 events microseconds apart don't
+// read as huge speeds; path length still adds up every step. Clicks are the
+// press and release edges of the button mask, and dwell runs from a
+// button's press to its release.
+typedef struct {
+    int have_ref, have_speed, have_accel;
+    uint64_t ref_ns;         // Start of the span being measured
+    double span_distance;    // Path length since ref_ns
+    int last_x, last_y;      // Previous sample
+    double speed, accel;
+    unsigned int mask;       // Previous button state
+    uint64_t press_ns[5];    // When buttons 1-5 went down, 0 if up
+    MotionSlice slices[MOTION_SLICES]; // Ring, indexed by slice % MOTION_SLICES
+    uint64_t slice;          // Current slice number (time_ns / slice length)
+    uint64_t time_ns;        // Newest sample
+    double distance;
+    unsigned long presses;
+    Histogram dwell;         // Press to release, ns
+} Motion;
 
-        if (!trail_points[current_index].valid) {
-            continue;
-        }
+// Hot path instrumentation, updated by both threads
+typedef struct {
+    Histogram query_rtt;   // XQueryPointer round trip (capture thread)
+    Histogram jitter;      // Poll wakeup lateness vs. its deadline (capture thread)
+    Histogram draw;        // Trail rendering, per overlay frame
+    Histogram flush;       // Pushing a frame out (cairo flush + XFlush / eglSwapBuffers)
+    Histogram lag;         // Newest sample's capture time to frame submitted
+    atomic_ulong samples;  // Samples taken off the ring
+    atomic_ulong frames;   // Overlay frames drawn
+    atomic_ulong coalesced; // Trail dots skipped by draw_trail's coalescing
+    atomic_ulong dropped;  // Samples lost to a full ring, all rings together
+    atomic_ulong missed_deadlines; // Polling ticks that came too late and were skipped
+    atomic_ulong net_frames; // --send: frames sent (sender thread)
+    atomic_ulong net_bytes;  // ... and their bytes on the wire
+    atomic_ulong net_dropped; // ... samples lost to a full queue or a failed send
+    atomic_ulong triggers;   // --trigger: triggers fired (capture thread)
+    atomic_ulong bursts;     // ... of them starting a new stretch of recording
+    Motion *motion[SEAT_MAX][POINTER_MAX]; // Render thread: set once a pointer is followed
+    // Render thread: startup milestones (CLOCK_MONOTONIC ns, 0 until reached)
+    uint64_t start_ns;       // main() entered
+    uint64_t ready_ns;       // Connections open, capture threads started
+    uint64_t first_sample_ns; // First sample taken off a ring
+    uint64_t first_frame_ns; // First overlay frame submitted
+} Stats;
 
-        double alpha = 1.0 - ((double)i / TRAIL_LENGTH);
-        if (alpha < 0.05) continue;
+Stats stats;
 
-        // <<<< MODIFIED: Set color based on 'clicked' flag >>>>
-        if (trail_points[current_index].clicked) {
-            // Clicked point: Use Red (adjust alpha slightly if desired)
-            cairo_set_source_rgba(cr, CLICK_R, CLICK_G, CLICK_B, alpha * 0.9);
-        } else {
-            // Normal point: Use configured trail color
-            cairo_set_source_rgba(cr, TRAIL_R, TRAIL_G, TRAIL_B, alpha * 0.8);
-        }
-        // <<<< END MODIFIED >>>>
+// Serves a stats report to every client connecting to a Unix socket. The
+// listening socket is part of the render thread's event loop.
+typedef struct {
+    const char *path;
+    int listen_fd;
+} StatsServer;
 
-        // Draw a circle at the point
-        cairo_arc(cr,
-                  trail_points[current_index].x,
-                  trail_points[current_index].y,
-                  TRAIL_RADIUS, 0, 2 * M_PI);
-        cairo_fill(cr);
-    }
-}
+// Log formats
+enum {
+    LOG_STATUS = 0, // Self-overwriting "\rMouse Coordinates" line, for terminals
+    LOG_CSV    = 1, // time_ns,x,y,mask,child
+    LOG_JSON   = 2, // One JSON object per line
+};
+
+// Metadata of one top-level window (the root child XQueryPointer
+// reports), with its log field already formatted for the log format
+typedef struct {
+    Window window;       // Key; None: empty slot
+    Window client;       // Window carrying WM_STATE (the app's), may equal window
+    int stale;           // Properties changed or window gone: refetch on use
+    char field[WINDOW_FIELD_MAX]; // E.g. ,"Firefox","Title" for CSV
+} WindowInfo;
+
+// Window attribution cache, owned by the render thread. It has its own X
+// connection, on which it watches the cached windows for PropertyNotify
+// (title/class changes) and DestroyNotify, so a sample's attribution is a
+// hash lookup and only a miss costs round trips.
+typedef struct {
+    Display *display;
+    int format;          // Log format the fields are formatted for
+    WindowInfo slots[WINDOW_CACHE_SIZE]; // Open addressing, linear probing
+    unsigned int used;
+    Atom wm_state, net_wm_name, utf8_string;
+    unsigned long hits, misses;
+} WindowCache;
 
+// Stdout logger, owned by the render thread. Lines are formatted into buf
+// and written out in large batches instead of one write(2) per sample.
+typedef struct {
+    int fd;
+    int format;
+    WindowCache **windows;     // Per seat: adds WM_CLASS and title to each line, NULL if off
+    int sources;               // Tag lines with seat and pointer (several are followed)
+    char buf[LOG_BUFFER_SIZE];
+    size_t len;
+    uint64_t pending_since_ns; // When the oldest unwritten line was added
+    Sample last;               // Latest sample, for LOG_STATUS
+    int have_last;
+} Logger;
+
+// Capture modes
+enum {
+    CAPTURE_POLL = 0, // XQueryPointer every UPDATE_INTERVAL
+    CAPTURE_XI2  = 1, // XInput2 raw events, wakes only on real input
+    CAPTURE_REPLAY = 2, // Samples come from a recorded trace (--replay)
+};
+
+// Valuator layout of one slave device, used to turn raw XI2 valuators into
+// root window coordinates without asking the server.
+typedef struct {
+    int deviceid;
+    int x_axis, y_axis;   // Valuator numbers of the X/Y axes, -1 if absent
+    int x_abs, y_abs;     // Axis reports positions (1) or deltas (0)
+    double x_min, x_max;  // Axis range; min >= max means values are already
+    double y_min, y_max;  // in screen coordinates (e.g. the XTEST pointer)
+} XI2Device;
+
+// One pointer followed by the capture thread: the core pointer, or with
+// --all-pointers one XI2 master pointer (MPX)
+typedef struct {
+    int master;                  // Master pointer device id, 0 for the core pointer
+    int active;                  // --all-pointers: slot in use
+    double x, y;                 // Tracked pointer position (root coordinates)
+    unsigned int mask;           // Tracked button state, core Button*Mask bits
+    Window child;                // Child window as of the last resync
+    int resync_pending;          // Position is estimated, confirm once input goes quiet
+    int last_x, last_y;          // Polling: position at the previous tick
+} XI2Pointer;
+
+// XI2 capture state
+typedef struct {
+    int opcode;                  // Major opcode of XInputExtension
+    int error_base;              // Its first error code
+    XI2Device devices[XI2_MAX_DEVICES];
+    int num_devices;
+    int all_pointers;            // Follow every master pointer, not just the core one
+    XI2Pointer pointers[POINTER_MAX]; // Indexed by Sample.pointer; only [0] without all_pointers
+} XI2State;
 
-int main() {
+// Everything the capture thread touches. It has its own X connection so
+// neither thread ever waits on the other's Xlib lock.
+typedef struct {
     Display *display;
     Window root_window;
-    Window overlay_window;
-    int screen;
     int width, height;
-    XSetWindowAttributes attrs;
+    int mode;            // CAPTURE_POLL, CAPTURE_XI2 or CAPTURE_REPLAY
+    long fast_interval;  // Polling: microseconds between samples while active
+    long idle_interval;  // Polling: longest interval once idle (== fast: fixed rate)
+    XI2State xi;
+    int seat;            // Sample.seat of everything captured here
+    SampleRing *ring;
+    TraceWriter *trace;  // Recording destination, NULL if not recording
+    TriggerRecorder *trigger; // --trigger: the trace only gets what this lets through
+    int resyncing;       // Samples being queued correct an XI2 estimate
+    TraceReader *replay; // Replay source (CAPTURE_REPLAY)
+    ShmPublisher *shm;   // Shared-memory publisher, NULL if not publishing
+    double replay_speed; // Replay: 1 = real time, N = N times faster, 0 = unthrottled
+    int stop_fd;         // eventfd, signalled by main to end the capture loop
+#ifdef HAVE_XCB
+    int use_xcb;         // --xcb: capture on 'conn' instead of 'display'
+    xcb_connection_t *conn;
+#endif
+} CaptureContext;
+
+typedef struct Overlay Overlay;
+
+// Render backend: everything that puts the trail onto the overlay window.
+// The window itself (visual, hints, click-through) is shared by all of them.
+typedef struct {
+    const char *name;
+    int (*init)(Overlay *overlay);         // 0 on success; on error leaves nothing allocated
+    void (*destroy)(Overlay *overlay);
+    int (*ready)(const Overlay *overlay);  // Can a new frame be drawn now?
+    void (*event)(Overlay *overlay, XEvent *ev); // Event read from the overlay connection
+    void (*draw)(Overlay *overlay, const Trail *trail);
+    uint64_t (*deadline)(const Overlay *overlay); // When ready() turns true by itself (0: never); may be NULL
+} RenderBackend;
+
+// cairo-xlib backend (the default, and the fallback for the others)
+typedef struct {
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    Damage drawn;        // Screen area covered by the last frame
+    SpriteAtlas sprites;
+
+    // Present extension: the trail is drawn into 'back' and copied to the
+    // window at the next vblank. Only one frame is in flight; while it is, new
+    // samples just accumulate in the trail, so no frame is drawn that would
+    // never be shown. The server hands 'back' over again with PresentIdleNotify,
+    // not with PresentCompleteNotify, so drawing waits for both.
+    int present;         // Present path in use (else draw straight to the window)
+    int present_opcode;
+    Pixmap back;
+    uint32_t present_serial;
+    int complete_pending; // Presented, PresentCompleteNotify not yet received
+    int idle_pending;     // Presented, PresentIdleNotify for 'back' not yet received
+    uint64_t presented_ns;
+} CairoRenderer;
+
+// MIT-SHM backend: cairo draws into an image surface whose pixels live in a
+// SysV shared-memory segment the server has attached, and only the damaged
+// rectangles are copied to the window with XShmPutImage. No pixel data goes
+// through the socket. The server reads the segment asynchronously, so no
+// new frame is drawn until its ShmCompletion event arrives.
+typedef struct {
+    XShmSegmentInfo shminfo;
+    XImage *image;
+    GC gc;
+    int completion_type; // Event type of ShmCompletion
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    Damage drawn;        // Screen area covered by the last frame
+    SpriteAtlas sprites;
+    int frame_pending;   // Uploads sent, ShmCompletion not yet received
+} XShmRenderer;
+
+// Heatmap layer (not a --renderer: it draws the seat's Heatmap, not a
+// trail). Changed tiles are scaled up from the heatmap image onto an
+// xlib surface, one tile per upload.
+typedef struct {
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    int full;            // Nothing drawn yet: paint every tile
+} HeatmapRenderer;
+
+#ifdef HAVE_EGL
+// EGL/GLES3 backend. The trail arrays are mirrored into vertex buffers
+// (only slots written since the last frame are uploaded) and drawn with a
+// single glDrawArrays(GL_POINTS); fade and color are worked out per point
+// in the vertex shader, so the CPU cost per frame doesn't depend on length.
+typedef struct {
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+    GLuint program;
+    GLuint vbo[3];       // Trail x, y and flags, slot 0 repeated after the last
+    GLint u_head, u_mask, u_length, u_visible, u_steps, u_lead, u_origin, u_screen;
+    unsigned int capacity;      // Trail slots in the vertex buffers (0: not allocated yet)
+    unsigned int uploaded_head; // Trail head as of the last upload
+    int vsync;                  // This overlay's swaps wait for vblank
+} EGLRenderer;
+#endif
+
+// Click-through ARGB window covering one monitor, the trail is drawn on it
+struct Overlay {
+    Display *display;
+    Window window;
+    Colormap colormap;
     Visual *visual;
     int depth;
-    Colormap colormap;
+    int x, y;            // Position on the root window: trail points are drawn at (x - this->x, y - this->y)
+    int width, height;
+    int dirty;           // Trail changed since this overlay last drew it
+    const RenderBackend *backend;
+    const Heatmap *heatmap; // Heatmap layer: the grid drawn instead of a trail
+    CairoRenderer cairo;
+    XShmRenderer xshm;
+    HeatmapRenderer heat;
+#ifdef HAVE_EGL
+    EGLRenderer egl;
+#endif
+};
 
-    // Variables for XQueryPointer
-    Window root_return, child_return;
-    int root_x_return, root_y_return;
-    int win_x_return, win_y_return;
-    unsigned int mask_return; // <<<< This holds the button state >>>>
+// One RandR monitor, or the whole screen when RandR 1.5 isn't available
+typedef struct {
+    Atom name;           // Identifies the monitor across configuration changes
+    int x, y, width, height;
+} Monitor;
+
+enum { ATOM_NET_WM_STATE, ATOM_NET_WM_STATE_ABOVE, ATOM_NET_WM_WINDOW_TYPE,
+       ATOM_NET_WM_WINDOW_TYPE_DOCK, OVERLAY_ATOMS };
+
+// What every overlay on one render connection shares, whichever pointer or
+// layer it belongs to. Only the visual is looked up at startup (from the
+// connection setup data, no round trip). The rest costs round trips and is
+// queried once, when the first sample wants an overlay: see
+// overlay_display_query.
+typedef struct {
+    Display *display;
+    int screen;
+    XVisualInfo vinfo;             // 32-bit ARGB visual shared by all overlays
+    int queried;                   // Everything below is filled in
+    int randr;                     // RandR 1.5 monitor list in use
+    int randr_event_base;
+    int xfixes;                    // Input shapes: overlays can be click-through
+    Atom atoms[OVERLAY_ATOMS];     // ATOM_*
+    Monitor monitors[OVERLAY_MAX_MONITORS]; // Current layout
+    int count;
+} OverlayDisplay;
 
-    // Cairo variables
-    cairo_surface_t *cairo_surface = NULL;
-    cairo_t *cr = NULL;
+// The overlay windows, one per monitor. A monitor's overlay is only created
+// once the pointer has been on it, so screens the pointer never visits cost
+// no window, surface or compositing.
+typedef struct {
+    OverlayDisplay *display;
+    const RenderBackend *backend;  // Requested renderer
+    Monitor monitors[OVERLAY_MAX_MONITORS]; // Layout the overlays were made for
+    Overlay overlays[OVERLAY_MAX_MONITORS]; // window == 0: not created (yet)
+    int count;
+    int current;                   // Monitor the pointer was last seen on (-1: none)
+    const Heatmap *heatmap;        // Heatmap layer: set on every overlay created
+} OverlaySet;
 
-    // --- Initialize Trail Buffer ---
-    // Note: memset also correctly initializes the new 'clicked' flag to 0
-    memset(trail_points, 0, sizeof(trail_points));
+// Render-side state of one pointer: its own trail, drawn on its own set of
+// overlays (stacked over the other pointers' ones on the same monitor)
+typedef struct {
+    int active;          // Has had a sample; trail (and overlays) set up
+    int overlay;         // overlays is initialized
+    Trail trail;
+    OverlaySet overlays;
+    int redraw;          // Trail changed since it was last drawn
+    uint64_t undrawn_ns; // Capture time of the newest sample not yet on screen
+    Motion motion;
+    Predictor predict;   // --predict
+} TrackedPointer;
 
-    // --- Setup Signal Handler ---
-    signal(SIGINT, handle_sigint);
+// One X display being followed (--display). It has a capture thread with
+// its own connection and ring; the render thread shares one connection
+// between the overlays of all the display's pointers.
+typedef struct {
+    const char *name;    // Display name, NULL for $DISPLAY
+    Display *display;    // Render connection (shared with capture when headless)
+    int screen;
+    int overlay;         // Draw trails (not --no-overlay)
+    const RenderBackend *backend;
+    unsigned int trail_length;
+    int interpolate;     // --interpolate
+    int predict;         // --predict model, PREDICT_NONE if off
+    SampleRing ring;
+    CaptureContext capture;
+    pthread_t capture_tid;
+    int capture_started;
+    WindowCache windows; // --windows
+    OverlayDisplay overlay_display; // Shared by every overlay set below
+    TrackedPointer pointers[POINTER_MAX]; // Indexed by Sample.pointer, set up on first use
+    int heat;            // --heatmap: heatmap is allocated
+    int heat_overlay;    // ... and drawn on heat_overlays
+    Heatmap heatmap;
+    OverlaySet heat_overlays; // Below the trails' overlays
+} Seat;
 
-    // --- Connect to the X Server ---
-    display = XOpenDisplay(NULL);
-    if (!display) {
-        fprintf(stderr, "Error: Could not open X display\n");
-        return 1;
+// The render thread's event loop: a single epoll set over every seat's ring
+// eventfd and render connection, a signalfd, a timerfd (log flush deadline)
+// and the stats socket. Each entry's data is EVENT_TAG(type, index).
+enum { EVENT_RING, EVENT_DISPLAY, EVENT_SIGNAL, EVENT_TIMER, EVENT_STATS };
+#define EVENT_TAG(type, index) ((uint64_t)(type) << 32 | (uint32_t)(index))
+#define EVENT_TYPE(tag) ((int)((tag) >> 32))
+#define EVENT_INDEX(tag) ((int)(uint32_t)(tag))
+#define LOOP_MAX_EVENTS 32
+
+typedef struct {
+    int epoll_fd;
+    int signal_fd;           // SIGINT, SIGTERM, SIGUSR1 (SIGUSR2), blocked in every thread
+    int timer_fd;
+    uint64_t timer_deadline; // CLOCK_MONOTONIC ns the timer is armed for, 0 if disarmed
+} EventLoop;
+
+uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time, so time spent working
+// between sleeps does not add to the period
+// The earlier of two deadlines, where 0 means none
+uint64_t deadline_min(uint64_t a, uint64_t b) {
+    return !a || (b && b < a) ? b : a;
+}
+
+void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && keep_running) {
+        // Interrupted: go back to sleep for whatever is left
+    }
+}
+
+// --- Stats ---
+
+unsigned int hist_index(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) return (unsigned int)v;
+    int e = 63 - __builtin_clzll(v); // e >= HIST_SUB_BITS
+    unsigned int sub = (unsigned int)(v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1);
+    return ((unsigned int)(e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+// Smallest value that lands in bucket 'index'
+uint64_t hist_value(unsigned int index) {
+    if (index < (1u << HIST_SUB_BITS)) return index;
+    int e = (int)(index >> HIST_SUB_BITS) - 1 + HIST_SUB_BITS;
+    uint64_t sub = index & ((1u << HIST_SUB_BITS) - 1);
+    return ((1ull << HIST_SUB_BITS) + sub) << (e - HIST_SUB_BITS);
+}
+
+void hist_record(Histogram *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->counts[hist_index(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, v, memory_order_relaxed,
+                                                             memory_order_relaxed)) {
+        // max was reloaded; retry while we are still larger
     }
+}
 
-    screen = DefaultScreen(display);
-    root_window = RootWindow(display, screen);
-    width = DisplayWidth(display, screen);
-    height = DisplayHeight(display, screen);
+// Value below which 'fraction' of the recorded values fall (bucket midpoint)
+uint64_t hist_percentile(const Histogram *h, unsigned long total, double fraction) {
+    unsigned long rank = (unsigned long)(total * fraction), seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen > rank) {
+            return i + 1 < HIST_BUCKETS ? (hist_value(i) + hist_value(i + 1)) / 2 : hist_value(i);
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
 
-    // --- Find a 32-bit visual ---
-    XVisualInfo vinfo_template;
-    vinfo_template.screen = screen; vinfo_template.depth = 32; vinfo_template.class = TrueColor;
-    int nitems;
-    XVisualInfo *vinfo_list = XGetVisualInfo(display, VisualScreenMask | VisualDepthMask | VisualClassMask, &vinfo_template, &nitems);
-    if (!vinfo_list || nitems == 0) { /* ... error handling ... */
-        fprintf(stderr, "Error: No 32-bit TrueColor visual found. Is a compositor running?\n");
-        XCloseDisplay(display); return 1;
+int stats_format_hist(char *buf, size_t size, const char *name, const Histogram *h) {
+    unsigned long total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    if (total == 0) return snprintf(buf, size, "%-10s count=0\n", name);
+    double mean = (double)atomic_load_explicit(&h->sum, memory_order_relaxed) / total;
+    return snprintf(buf, size,
+                    "%-10s count=%lu mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+                    name, total, mean / 1000,
+                    hist_percentile(h, total, 0.50) / 1000.0, hist_percentile(h, total, 0.90) / 1000.0,
+                    hist_percentile(h, total, 0.99) / 1000.0, hist_percentile(h, total, 0.999) / 1000.0,
+                    atomic_load_explicit(&h->max, memory_order_relaxed) / 1000.0);
+}
+
+// --- Motion Analytics ---
+
+// Slice for a sample at time_ns, clearing the ones that fell out of the
+// window since the last sample (at most MOTION_SLICES)
+MotionSlice *motion_slice(Motion *m, uint64_t time_ns) {
+    uint64_t slice = time_ns / (MOTION_WINDOW_MS * 1000000ull / MOTION_SLICES);
+    if (slice > m->slice) {
+        uint64_t first = slice - m->slice > MOTION_SLICES ? slice - MOTION_SLICES + 1 : m->slice + 1;
+        for (uint64_t i = first; i <= slice; ++i) {
+            memset(&m->slices[i % MOTION_SLICES], 0, sizeof(MotionSlice));
+        }
+        m->slice = slice;
     }
-    visual = vinfo_list[0].visual; depth = vinfo_list[0].depth;
+    return &m->slices[m->slice % MOTION_SLICES]; // Time going backwards stays in the current slice
+}
 
-    // --- Create Colormap ---
-    colormap = XCreateColormap(display, root_window, visual, AllocNone);
+void motion_push(Motion *m, const Sample *sample) {
+    uint64_t t = sample->time_ns;
+    MotionSlice *slice = motion_slice(m, t);
+    m->time_ns = t;
 
-    // --- Set Window Attributes ---
-    attrs.override_redirect = True; attrs.colormap = colormap;
-    attrs.background_pixel = 0; attrs.border_pixel = 0;
-    unsigned long valuemask = CWOverrideRedirect | CWColormap | CWBackPixel | CWBorderPixel;
+    // 1. Button edges: a press is a bit that just went up, a release one
+    // that just went down
+    unsigned int pressed = sample->mask & ~m->mask & BUTTON_MASK_ANY;
+    unsigned int released = m->mask & ~sample->mask & BUTTON_MASK_ANY;
+    m->mask = sample->mask;
+    for (int b = 0; (pressed | released) && b < 5; ++b) {
+        unsigned int bit = Button1Mask << b;
+        if (pressed & bit) {
+            m->press_ns[b] = t;
+            m->presses++;
+            slice->presses++;
+        } else if ((released & bit) && m->press_ns[b]) {
+            hist_record(&m->dwell, t - m->press_ns[b]);
+            m->press_ns[b] = 0;
+        }
+    }
 
-    // --- Create Overlay Window ---
-    overlay_window = XCreateWindow(display, root_window, 0, 0, width, height, 0,
-                                   depth, InputOutput, visual, valuemask, &attrs);
+    // 2. Path length
+    if (!m->have_ref) {
+        m->have_ref = 1;
+        m->ref_ns = t;
+        m->last_x = sample->x;
+        m->last_y = sample->y;
+        return;
+    }
+    double dx = sample->x - m->last_x, dy = sample->y - m->last_y;
+    double step = sqrt(dx * dx + dy * dy);
+    m->last_x = sample->x;
+    m->last_y = sample->y;
+    m->distance += step;
+    m->span_distance += step;
+    slice->distance += step;
 
-    // --- Set EWMH Properties ---
-    Atom wm_state = XInternAtom(display, "_NET_WM_STATE", False);
-    Atom wm_state_above = XInternAtom(display, "_NET_WM_STATE_ABOVE", False);
-    if (wm_state != None && wm_state_above != None) {
-        XChangeProperty(display, overlay_window, wm_state, XA_ATOM, 32, PropModeReplace, (unsigned char *)&wm_state_above, 1);
-    } // else { fprintf(stderr, "Warning: Could not set _NET_WM_STATE_ABOVE.\n"); }
-    Atom wm_window_type = XInternAtom(display, "_NET_WM_WINDOW_TYPE", False);
-    Atom wm_window_type_dock = XInternAtom(display, "_NET_WM_WINDOW_TYPE_DOCK", False);
-    if (wm_window_type != None && wm_window_type_dock != None) {
-         XChangeProperty(display, overlay_window, wm_window_type, XA_ATOM, 32, PropModeReplace, (unsigned char *)&wm_window_type_dock, 1);
+    // 3. Speed, acceleration and jerk, once the span is long enough
+    if (t < m->ref_ns + MOTION_MIN_DT_MS * 1000000ull) return;
+    double dt = (t - m->ref_ns) / 1e9;
+    double speed = m->span_distance / dt;
+    if (m->have_speed) {
+        double accel = (speed - m->speed) / dt;
+        if (m->have_accel && fabs(accel - m->accel) / dt > slice->peak_jerk) {
+            slice->peak_jerk = fabs(accel - m->accel) / dt;
+        }
+        if (fabs(accel) > slice->peak_accel) slice->peak_accel = fabs(accel);
+        m->accel = accel;
+        m->have_accel = 1;
+    }
+    if (speed > slice->peak_speed) slice->peak_speed = speed;
+    m->speed = speed;
+    m->have_speed = 1;
+    m->ref_ns = t;
+    m->span_distance = 0;
+}
+
+// Fold the window into a summary, O(MOTION_SLICES). Returns 0 if the
+// pointer has no samples yet.
+int motion_summary(const Motion *m, MotionSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (!m->time_ns) return 0;
+    summary->time_ns = m->time_ns;
+    summary->speed = m->speed;
+    summary->accel = m->accel;
+    for (int i = 0; i < MOTION_SLICES; ++i) {
+        const MotionSlice *slice = &m->slices[i];
+        summary->window.distance += slice->distance;
+        summary->window.presses += slice->presses;
+        if (slice->peak_speed > summary->window.peak_speed) summary->window.peak_speed = slice->peak_speed;
+        if (slice->peak_accel > summary->window.peak_accel) summary->window.peak_accel = slice->peak_accel;
+        if (slice->peak_jerk > summary->window.peak_jerk) summary->window.peak_jerk = slice->peak_jerk;
     }
+    summary->distance = m->distance;
+    summary->presses = m->presses;
+    summary->held = m->mask & BUTTON_MASK_ANY;
+    return 1;
+}
 
-    // --- Enable Click-Through ---
-    int fix_event_base, fix_error_base;
-    if (XFixesQueryExtension(display, &fix_event_base, &fix_error_base)) {
-        XserverRegion region = XFixesCreateRegion(display, NULL, 0);
-        XFixesSetWindowShapeRegion(display, overlay_window, ShapeInput, 0, 0, region);
-        XFixesDestroyRegion(display, region);
+// Render the current stats as text. Returns the length written.
+size_t stats_format(char *buf, size_t size) {
+    size_t len = 0;
+    len += snprintf(buf + len, size - len,
+                    "samples=%lu frames=%lu coalesced=%lu dropped=%lu missed_deadlines=%lu (times in us)\n",
+                    atomic_load(&stats.samples), atomic_load(&stats.frames), atomic_load(&stats.coalesced),
+                    atomic_load(&stats.dropped), atomic_load(&stats.missed_deadlines));
+    const struct { const char *name; const Histogram *h; } hists[] = {
+        { "query_rtt", &stats.query_rtt }, { "jitter", &stats.jitter }, { "draw", &stats.draw },
+        { "flush", &stats.flush }, { "lag", &stats.lag },
+    };
+    for (size_t i = 0; i < sizeof(hists) / sizeof(hists[0]) && len < size; ++i) {
+        len += stats_format_hist(buf + len, size - len, hists[i].name, hists[i].h);
+    }
+    if (stats.start_ns && len < size) {
+        // Milestones not reached yet print as -1
+        double ms[3];
+        const uint64_t at[3] = { stats.ready_ns, stats.first_sample_ns, stats.first_frame_ns };
+        for (int i = 0; i < 3; ++i) ms[i] = at[i] ? (at[i] - stats.start_ns) / 1e6 : -1.0;
+        len += snprintf(buf + len, size - len, "startup    ready=%.2fms first_sample=%.2fms first_frame=%.2fms\n",
+                        ms[0], ms[1], ms[2]);
+    }
+    unsigned long net_frames = atomic_load(&stats.net_frames), net_dropped = atomic_load(&stats.net_dropped);
+    if ((net_frames || net_dropped) && len < size) {
+        len += snprintf(buf + len, size - len, "net        frames=%lu bytes=%lu dropped=%lu\n",
+                        net_frames, atomic_load(&stats.net_bytes), net_dropped);
+    }
+    unsigned long triggers = atomic_load(&stats.triggers);
+    if (triggers && len < size) {
+        len += snprintf(buf + len, size - len, "trigger    fired=%lu bursts=%lu\n",
+                        triggers, atomic_load(&stats.bursts));
+    }
+
+    // Per pointer motion (distances in px, times in s) and click dwell
+    for (int s = 0; s < SEAT_MAX; ++s) {
+        for (int p = 0; p < POINTER_MAX && len < size; ++p) {
+            const Motion *m = stats.motion[s][p];
+            MotionSummary sum;
+            if (!m || !motion_summary(m, &sum)) continue;
+            len += snprintf(buf + len, size - len,
+                            "motion %d.%d speed=%.0f accel=%.0f distance=%.0f presses=%lu held=%#x\n"
+                            "  last %dms: distance=%.0f peak_speed=%.0f peak_accel=%.0f peak_jerk=%.0f presses=%lu\n",
+                            s, p, sum.speed, sum.accel, sum.distance, sum.presses, sum.held,
+                            MOTION_WINDOW_MS, sum.window.distance, sum.window.peak_speed,
+                            sum.window.peak_accel, sum.window.peak_jerk, sum.window.presses);
+            if (len < size) len += stats_format_hist(buf + len, size - len, "  dwell", &m->dwell);
+        }
+    }
+    return len < size ? len : size - 1;
+}
+
+void stats_dump(int fd) {
+    char buf[STATS_REPORT_SIZE];
+    size_t len = stats_format(buf, sizeof(buf));
+    if (write(fd, buf, len) < 0) { /* nothing to do */ }
+}
+
+// Listen on a Unix socket; each client that connects gets one report
+int stats_server_open(StatsServer *server, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Stats socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    server->path = path;
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        perror("stats socket");
+        return -1;
+    }
+    unlink(path); // Left over from a previous run
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 8) != 0) {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", path, strerror(errno));
+        close(server->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void stats_server_close(StatsServer *server) {
+    close(server->listen_fd);
+    unlink(server->path);
+}
+
+// Answer every client waiting on the socket. Client sockets are
+// non-blocking and a report fits in the socket buffer, so this never
+// holds up the render thread on a client that doesn't read.
+void stats_server_serve(StatsServer *server) {
+    int client;
+    while ((client = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        stats_dump(client);
+        close(client);
+    }
+}
+
+// --- Trail ---
+
+int16_t clamp_i16(int v) {
+    return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : (int16_t)v;
+}
+
+// Allocate a trail of 'length' points. Returns 0 on success, -1 on error.
+int trail_init(Trail *trail, unsigned int length) {
+    unsigned int capacity = 1;
+    while (capacity < length) capacity <<= 1;
+
+    memset(trail, 0, sizeof(*trail));
+    trail->x = calloc(capacity, sizeof(*trail->x));
+    trail->y = calloc(capacity, sizeof(*trail->y));
+    trail->flags = calloc(capacity, sizeof(*trail->flags)); // All slots start invalid
+    if (!trail->x || !trail->y || !trail->flags) {
+        free(trail->x); free(trail->y); free(trail->flags);
+        return -1;
+    }
+    trail->mask = capacity - 1;
+    trail->length = length;
+    return 0;
+}
+
+void trail_free(Trail *trail) {
+    free(trail->x);
+    free(trail->y);
+    free(trail->flags);
+    memset(trail, 0, sizeof(*trail));
+}
+
+// Number of points, newest first, whose fade alpha (1 - i / length) is
+// still at least 0.05
+unsigned int trail_visible(const Trail *trail) {
+    unsigned int visible = (unsigned int)(trail->length * 0.95) + 1;
+    return visible < trail->length ? visible : trail->length;
+}
+
+// --- Motion Prediction ---
+
+void predict_push(Predictor *pr, const Sample *sample, uint64_t arrived_ns) {
+    unsigned int newest = (pr->head - 1) % PREDICT_HISTORY;
+    double dt = pr->count ? (double)sample->time_ns - (double)pr->time_ns[newest] : 0;
+
+    // After a pause (or out-of-order samples) the old velocity means nothing
+    if (pr->count && (dt < 0 || dt > PREDICT_MAX_MS * 1e6)) {
+        pr->count = 0;
+        dt = 0;
+    }
+    if (pr->count == 0) {
+        pr->px = sample->x; pr->py = sample->y;
+        pr->vx = pr->vy = 0;
+    } else if (dt > 0) {
+        pr->interval_ns = pr->interval_ns > 0 ? 0.8 * pr->interval_ns + 0.2 * dt : dt;
+        // Alpha-beta filter: a steady-state Kalman filter for constant velocity
+        double rx = sample->x - (pr->px + pr->vx * dt), ry = sample->y - (pr->py + pr->vy * dt);
+        pr->px += pr->vx * dt + PREDICT_ALPHA * rx;
+        pr->py += pr->vy * dt + PREDICT_ALPHA * ry;
+        pr->vx += PREDICT_BETA * rx / dt;
+        pr->vy += PREDICT_BETA * ry / dt;
+    }
+
+    unsigned int slot = pr->head++ % PREDICT_HISTORY;
+    pr->time_ns[slot] = sample->time_ns;
+    pr->x[slot] = sample->x;
+    pr->y[slot] = sample->y;
+    if (pr->count < PREDICT_HISTORY) pr->count++;
+    pr->arrived_ns = arrived_ns;
+}
+
+// When the pointer counts as stopped, if no sample comes before then
+uint64_t predict_deadline(const Predictor *pr) {
+    double hold = 2 * pr->interval_ns;
+    if (hold < PREDICT_HOLD_MIN_MS * 1e6) hold = PREDICT_HOLD_MIN_MS * 1e6;
+    return pr->arrived_ns + (uint64_t)hold;
+}
+
+// Where the pointer is expected to be when a frame drawn at 'now' is on
+// screen. Returns 0 if it isn't moving (or has stopped), 1 otherwise.
+int predict_lead(const Predictor *pr, uint64_t now, double *x, double *y) {
+    if (pr->count < 2 || now > predict_deadline(pr)) return 0;
+    double horizon = (double)(now - pr->arrived_ns) + PREDICT_LEAD_MS * 1e6;
+    if (horizon > PREDICT_MAX_MS * 1e6) horizon = PREDICT_MAX_MS * 1e6;
+
+    unsigned int newest = (pr->head - 1) % PREDICT_HISTORY;
+    double dx, dy;
+    if (pr->model == PREDICT_KALMAN) {
+        dx = pr->px + pr->vx * horizon - pr->x[newest];
+        dy = pr->py + pr->vy * horizon - pr->y[newest];
     } else {
-        fprintf(stderr, "Warning: XFixes extension not available. Overlay will not be click-through.\n");
+        // Straight line through the oldest sample in the window and the newest
+        unsigned int oldest = newest;
+        for (unsigned int i = 1; i < pr->count; ++i) {
+            unsigned int slot = (pr->head - 1 - i) % PREDICT_HISTORY;
+            if (pr->time_ns[newest] - pr->time_ns[slot] > PREDICT_WINDOW_MS * 1000000ull) break;
+            oldest = slot;
+        }
+        double span = (double)(pr->time_ns[newest] - pr->time_ns[oldest]);
+        if (span <= 0) return 0;
+        dx = (pr->x[newest] - pr->x[oldest]) / span * horizon;
+        dy = (pr->y[newest] - pr->y[oldest]) / span * horizon;
     }
+    if (dx * dx + dy * dy > PREDICT_MAX_PX * PREDICT_MAX_PX) return 0;
+    *x = pr->x[newest] + dx;
+    *y = pr->y[newest] + dy;
+    return 1;
+}
 
-    // --- Map Window & Flush ---
-    XMapWindow(display, overlay_window);
-    XFlush(display);
+// Move the trail's predicted head for a frame drawn at 'now'. Returns 1 if
+// it moved, appeared or went away, i.e. the trail needs redrawing.
+int trail_predict(Trail *trail, const Predictor *pr, uint64_t now) {
+    unsigned int newest = (trail->head - 1) & trail->mask;
+    double x, y;
+    int lead = (trail->flags[newest] & TRAIL_VALID) && predict_lead(pr, now, &x, &y);
+    int16_t lead_x = lead ? clamp_i16((int)lround(x)) : 0, lead_y = lead ? clamp_i16((int)lround(y)) : 0;
+    if (lead && lead_x == trail->x[newest] && lead_y == trail->y[newest]) lead = 0;
 
-    // --- Setup Cairo ---
-    cairo_surface = cairo_xlib_surface_create(display, overlay_window, visual, width, height);
-    if (!cairo_surface || cairo_surface_status(cairo_surface) != CAIRO_STATUS_SUCCESS) { /* ... error handling ... */
-         fprintf(stderr, "Error creating Cairo surface: %s\n", cairo_status_to_string(cairo_surface_status(cairo_surface)));
-         XFree(vinfo_list); XDestroyWindow(display, overlay_window); XFreeColormap(display, colormap); XCloseDisplay(display); return 1;
+    if (lead == trail->lead && (!lead || (lead_x == trail->lead_x && lead_y == trail->lead_y))) return 0;
+    trail->lead = lead;
+    trail->lead_x = lead_x;
+    trail->lead_y = lead_y;
+    return 1;
+}
+
+// --- Heatmap ---
+
+void heatmap_free(Heatmap *hm) {
+    free(hm->counts);
+    free(hm->tile_dirty);
+    free(hm->dirty);
+    if (hm->image) cairo_surface_destroy(hm->image);
+    memset(hm, 0, sizeof(*hm));
+}
+
+// Allocate a grid of cell x cell pixel cells over a width x height screen.
+// Returns 0 on success, -1 on error.
+int heatmap_init(Heatmap *hm, int width, int height, int cell) {
+    memset(hm, 0, sizeof(*hm));
+    hm->cell = cell;
+    hm->screen_width = width;
+    hm->screen_height = height;
+    hm->width = (width + cell - 1) / cell;
+    hm->height = (height + cell - 1) / cell;
+    hm->tiles_x = (hm->width + HEATMAP_TILE - 1) / HEATMAP_TILE;
+    hm->tiles_y = (hm->height + HEATMAP_TILE - 1) / HEATMAP_TILE;
+    size_t tiles = (size_t)hm->tiles_x * hm->tiles_y;
+    hm->counts = calloc((size_t)hm->width * hm->height, sizeof(*hm->counts));
+    hm->tile_dirty = calloc(tiles, sizeof(*hm->tile_dirty));
+    hm->dirty = malloc(tiles * sizeof(*hm->dirty));
+    hm->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, hm->width, hm->height); // Transparent
+    if (!hm->counts || !hm->tile_dirty || !hm->dirty ||
+        cairo_surface_status(hm->image) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Error: Could not allocate a %dx%d heatmap\n", hm->width, hm->height);
+        heatmap_free(hm);
+        return -1;
     }
-    cr = cairo_create(cairo_surface);
-    if (!cr || cairo_status(cr) != CAIRO_STATUS_SUCCESS) { /* ... error handling ... */
-        fprintf(stderr, "Error creating Cairo context: %s\n", cairo_status_to_string(cairo_status(cr)));
-        if (cairo_surface) cairo_surface_destroy(cairo_surface);
-        XFree(vinfo_list); XDestroyWindow(display, overlay_window); XFreeColormap(display, colormap); XCloseDisplay(display); return 1;
+    cairo_surface_flush(hm->image); // Written directly from here on
+    hm->pixels = (uint32_t *)cairo_image_surface_get_data(hm->image);
+    hm->stride = cairo_image_surface_get_stride(hm->image) / 4;
+    hm->scale = 1;
+    hm->inv_log_scale = 1.0f;
+
+    // Blue, cyan, green, yellow, red, fading in from transparent
+    for (int level = 1; level < 256; ++level) {
+        double t = level / 255.0, hue = 0.875 * t, a = HEATMAP_ALPHA * (0.25 + 0.75 * t);
+        double rgb[3] = { 1.5 - fabs(4 * hue - 3), 1.5 - fabs(4 * hue - 2), 1.5 - fabs(4 * hue - 1) };
+        uint32_t color = (uint32_t)(a * 255 + 0.5) << 24;
+        for (int c = 0; c < 3; ++c) {
+            double v = rgb[c] < 0 ? 0 : rgb[c] > 1 ? 1 : rgb[c];
+            color |= (uint32_t)(v * a * 255 + 0.5) << (16 - 8 * c);
+        }
+        hm->colors[level] = color;
     }
+    return 0;
+}
 
-    // --- Free Visual Info ---
-    XFree(vinfo_list); vinfo_list = NULL;
+static inline uint32_t heatmap_color(const Heatmap *hm, uint32_t count) {
+    if (!count) return 0;
+    int level = 1 + (int)(254 * log2f(1.0f + count) * hm->inv_log_scale);
+    return hm->colors[level < 255 ? level : 255];
+}
 
-    printf("Mouse trail overlay started. Press Ctrl+C to exit.\n");
-    printf("\rMouse Coordinates: X=     Y=     "); fflush(stdout);
+void heatmap_mark(Heatmap *hm, int tile) {
+    if (hm->tile_dirty[tile]) return;
+    hm->tile_dirty[tile] = 1;
+    hm->dirty[hm->ndirty++] = tile;
+}
 
-    // --- Main Loop ---
-    while (keep_running) {
-        // 1. Get current mouse position AND button state
-        Bool result = XQueryPointer(display, root_window,
-                                    &root_return, &child_return,
-                                    &root_x_return, &root_y_return,
-                                    &win_x_return, &win_y_return,
-                                    &mask_return); // Contains button state
-
-        if (result) {
-            // Print coordinates
-            printf("\rMouse Coordinates: X=%-5d Y=%-5d", root_x_return, root_y_return);
-            fflush(stdout);
-
-            // 2. Store the new point in the circular buffer
-            trail_points[trail_head].x = root_x_return;
-            trail_points[trail_head].y = root_y_return;
-            trail_points[trail_head].valid = 1;
-
-            // <<<< NEW: Check button state and set clicked flag >>>>
-            // Check if any of Button1Mask to Button5Mask are set in mask_return
-            if (mask_return & (Button1Mask | Button2Mask | Button3Mask | Button4Mask | Button5Mask)) {
-                trail_points[trail_head].clicked = 1; // A button was pressed
-            } else {
-                trail_points[trail_head].clicked = 0; // No button was pressed
-            }
-            // <<<< END NEW >>>>
+// Count a sample: 1 if its pointer moved, HEATMAP_CLICK_WEIGHT more if a
+// button went down. A pointer at rest adds nothing.
+void heatmap_push(Heatmap *hm, const Sample *sample) {
+    if (sample->pointer >= POINTER_MAX) return;
+    HeatmapPointer *last = &hm->last[sample->pointer];
+    int moved = !last->seen || sample->x != last->x || sample->y != last->y;
+    int pressed = (sample->mask & ~last->mask & BUTTON_MASK_ANY) != 0;
+    *last = (HeatmapPointer){ 1, sample->x, sample->y, sample->mask };
 
-            trail_head = (trail_head + 1) % TRAIL_LENGTH; // Move head
+    uint32_t weight = (uint32_t)moved + (pressed ? HEATMAP_CLICK_WEIGHT : 0);
+    if (!weight || sample->x < 0 || sample->y < 0) return;
+    int cx = sample->x / hm->cell, cy = sample->y / hm->cell;
+    if (cx >= hm->width || cy >= hm->height) return; // Screen grew since start
 
-            // 3. Draw the entire trail onto the Cairo surface
-            draw_trail(cr, width, height);
+    uint32_t *count = &hm->counts[(size_t)cy * hm->width + cx];
+    if (*count > UINT32_MAX - weight) return;
+    *count += weight;
+    if (*count > hm->max) hm->max = *count;
+    // Past the scale, heatmap_update recolors everything anyway
+    if (*count <= hm->scale) hm->pixels[(size_t)cy * hm->stride + cx] = heatmap_color(hm, *count);
+    heatmap_mark(hm, (cy / HEATMAP_TILE) * hm->tiles_x + cx / HEATMAP_TILE);
+}
 
-            // 4. Flush drawing to the screen
-            cairo_surface_flush(cairo_surface);
+// Bring the image up to date with the counts. Returns the number of tiles
+// changed since they were last drawn.
+int heatmap_update(Heatmap *hm) {
+    if (hm->max > hm->scale) {
+        while (hm->scale < hm->max && hm->scale < (1u << 31)) hm->scale *= 2;
+        hm->inv_log_scale = 1.0f / log2f(1.0f + hm->scale);
+        for (int y = 0; y < hm->height; ++y) {
+            const uint32_t *counts = &hm->counts[(size_t)y * hm->width];
+            uint32_t *row = &hm->pixels[(size_t)y * hm->stride];
+            for (int x = 0; x < hm->width; ++x) row[x] = heatmap_color(hm, counts[x]);
+        }
+        for (int tile = 0; tile < hm->tiles_x * hm->tiles_y; ++tile) heatmap_mark(hm, tile);
+    }
+    if (hm->ndirty) cairo_surface_mark_dirty(hm->image);
+    return hm->ndirty;
+}
 
-        } else {
-            // Handle query failure
-             printf("\rMouse Coordinates: Query Failed!   "); fflush(stdout);
-             fprintf(stderr, "\nWarning: XQueryPointer failed.\n");
-             usleep(100000); // Sleep longer
+// Every overlay has drawn the changed tiles
+void heatmap_drawn(Heatmap *hm) {
+    for (int i = 0; i < hm->ndirty; ++i) hm->tile_dirty[hm->dirty[i]] = 0;
+    hm->ndirty = 0;
+}
+
+// Snapshot to a PNG at screen resolution, each cell a block of pixels.
+// Returns 0 on success, -1 on error.
+int heatmap_write_png(Heatmap *hm, const char *path) {
+    heatmap_update(hm);
+    cairo_surface_t *out = hm->image;
+    if (hm->cell > 1) {
+        out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, hm->screen_width, hm->screen_height);
+        cairo_t *cr = cairo_create(out);
+        cairo_scale(cr, hm->cell, hm->cell);
+        cairo_set_source_surface(cr, hm->image, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+    }
+    cairo_status_t status = cairo_surface_write_to_png(out, path);
+    if (out != hm->image) cairo_surface_destroy(out);
+    if (status != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Error: Could not write heatmap %s: %s\n", path, cairo_status_to_string(status));
+        return -1;
+    }
+    return 0;
+}
+
+// --- Damage Tracking ---
+
+// Add a rectangle, clipped to the screen. Overlapping neighbours (the usual
+// case for consecutive trail points) are merged; once the list is full
+// everything collapses into a single bounding box.
+void damage_add(Damage *damage, int x1, int y1, int x2, int y2, int width, int height) {
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > width) x2 = width;
+    if (y2 > height) y2 = height;
+    if (x1 >= x2 || y1 >= y2) return;
+
+    if (damage->count > 0) {
+        DirtyRect *last = &damage->rects[damage->count - 1];
+        if (x1 < last->x2 && x2 > last->x1 && y1 < last->y2 && y2 > last->y1) {
+            if (x1 < last->x1) last->x1 = x1;
+            if (y1 < last->y1) last->y1 = y1;
+            if (x2 > last->x2) last->x2 = x2;
+            if (y2 > last->y2) last->y2 = y2;
+            return;
+        }
+    }
+
+    if (damage->count == DAMAGE_MAX_RECTS) {
+        DirtyRect *box = &damage->rects[0];
+        for (int i = 1; i < damage->count; ++i) {
+            DirtyRect *r = &damage->rects[i];
+            if (r->x1 < box->x1) box->x1 = r->x1;
+            if (r->y1 < box->y1) box->y1 = r->y1;
+            if (r->x2 > box->x2) box->x2 = r->x2;
+            if (r->y2 > box->y2) box->y2 = r->y2;
         }
+        damage->count = 1;
+        damage_add(damage, x1, y1, x2, y2, width, height);
+        return;
+    }
 
-        // 5. Pause briefly
-        usleep(UPDATE_INTERVAL);
+    DirtyRect *r = &damage->rects[damage->count++];
+    r->x1 = x1; r->y1 = y1; r->x2 = x2; r->y2 = y2;
+}
 
-    } // End main loop
+// Append the rectangles of a damage list to the current cairo path
+void damage_path(cairo_t *cr, const Damage *damage) {
+    for (int i = 0; i < damage->count; ++i) {
+        const DirtyRect *r = &damage->rects[i];
+        cairo_rectangle(cr, r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1);
+    }
+}
+
+// --- Sprite Atlas ---
+
+// Render every dot variant once, into a surface similar to 'target' so that
+// blitting from it stays on the same side of the wire (server-side for xlib).
+// Returns 0 on success, -1 on error.
+int sprites_create(SpriteAtlas *atlas, cairo_surface_t *target) {
+    atlas->extent = (int)ceil(TRAIL_RADIUS) + 1; // Padded for anti-aliasing
+    atlas->cell = 2 * atlas->extent;
+    atlas->surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA,
+                                                  atlas->cell * SPRITE_LEVELS, atlas->cell * 2);
+    if (cairo_surface_status(atlas->surface) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Error creating sprite atlas: %s\n",
+                cairo_status_to_string(cairo_surface_status(atlas->surface)));
+        cairo_surface_destroy(atlas->surface);
+        atlas->surface = NULL;
+        return -1;
+    }
+
+    cairo_t *cr = cairo_create(atlas->surface);
+    cairo_set_source_rgba(cr, 0, 0, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    for (int level = 0; level < SPRITE_LEVELS; ++level) {
+        double alpha = (double)level / (SPRITE_LEVELS - 1);
+        double cx = level * atlas->cell + atlas->extent;
+
+        // Normal point: Use configured trail color
+        cairo_set_source_rgba(cr, TRAIL_R, TRAIL_G, TRAIL_B, alpha * 0.8);
+        cairo_arc(cr, cx, atlas->extent, TRAIL_RADIUS, 0, 2 * M_PI);
+        cairo_fill(cr);
+
+        // Clicked point: Use Red (adjust alpha slightly if desired)
+        cairo_set_source_rgba(cr, CLICK_R, CLICK_G, CLICK_B, alpha * 0.9);
+        cairo_arc(cr, cx, atlas->cell + atlas->extent, TRAIL_RADIUS, 0, 2 * M_PI);
+        cairo_fill(cr);
+    }
+    cairo_destroy(cr);
+    cairo_surface_flush(atlas->surface);
+    return 0;
+}
+
+void sprites_destroy(SpriteAtlas *atlas) {
+    if (atlas->surface) cairo_surface_destroy(atlas->surface);
+    atlas->surface = NULL;
+}
+
+// Render-path coalescing. Walking the trail newest first, a point is skipped
+// when it lies within TRAIL_COALESCE_DIST of the last point kept and has the
+// same color: its dot would be blitted almost exactly under that one. A
+// resting pointer is then a single blit, and a long or densely sampled trail
+// costs blits in proportion to the path on screen, not to the sample count.
+// Returns 1 if the point is drawn; keeps its state in *last (init row to -1).
+typedef struct { int x, y, row; } CoalesceState;
+
+int trail_coalesce(const Trail *trail, unsigned int index, CoalesceState *last) {
+    int x = trail->x[index], y = trail->y[index];
+    int row = (trail->flags[index] & TRAIL_CLICKED) ? 1 : 0;
+    int dx = x - last->x, dy = y - last->y;
+
+    if (row == last->row && dx * dx + dy * dy < TRAIL_COALESCE_DIST * TRAIL_COALESCE_DIST) return 0;
+    last->x = x; last->y = y; last->row = row;
+    return 1;
+}
+
+// Number of parts the gap between two dots dx, dy apart is drawn in: with
+// --interpolate, enough for dots at most TRAIL_INTERP_SPACING apart (up to
+// TRAIL_INTERP_STEPS), unless the gap is a jump; otherwise 1
+static inline int trail_segment_steps(const Trail *trail, int dx, int dy) {
+    if (!trail->interpolate) return 1;
+    double d = sqrt((double)dx * dx + (double)dy * dy);
+    if (d <= TRAIL_INTERP_SPACING || d > TRAIL_INTERP_MAX_DIST) return 1;
+    int n = (int)ceil(d / TRAIL_INTERP_SPACING);
+    return n < TRAIL_INTERP_STEPS ? n : TRAIL_INTERP_STEPS;
+}
+
+// One dot centred on (px, py) of the overlay: the first pass only adds its
+// box to *damage, the second (paint) blits its sprite
+static inline void trail_dot(cairo_t *cr, const SpriteAtlas *sprites, Damage *damage, int paint,
+                             int px, int py, double alpha, int row, int width, int height) {
+    const int extent = sprites->extent;
+    const int cell = sprites->cell;
+    if (!paint) {
+        damage_add(damage, px - extent, py - extent, px + extent, py + extent, width, height);
+        return;
+    }
+    // Blit the sprite for this color and alpha level onto the point
+    int level = (int)(alpha * (SPRITE_LEVELS - 1) + 0.5);
+    int x = px - extent, y = py - extent;
+    if (x >= width || y >= height || x + cell <= 0 || y + cell <= 0) return; // On another monitor
+    cairo_set_source_surface(cr, sprites->surface, x - level * cell, y - row * cell);
+    cairo_rectangle(cr, x, y, cell, cell);
+    cairo_fill(cr);
+}
+
+// Walk the trail's dots newest first: the predicted head if there is one,
+// then every point not coalesced away, each with the dots interpolated
+// between it and the newer one. Both passes of draw_trail go through here,
+// so they see exactly the same dots. Returns the number of points coalesced.
+static inline unsigned long trail_walk(cairo_t *cr, const Trail *trail, const SpriteAtlas *sprites,
+                                       Damage *damage, int paint, int x0, int y0, int width, int height) {
+    // Points past 'visible' have faded below 5% and aren't drawn
+    const unsigned int visible = trail_visible(trail);
+    CoalesceState last = { 0, 0, -1 };
+    unsigned long coalesced = 0;
+    int newer = 0, newer_x = 0, newer_y = 0, newer_row = 0; // Dot the next segment runs to
+    double newer_alpha = 1.0;
+
+    unsigned int head = (trail->head - 1) & trail->mask;
+    if (trail->lead && visible && (trail->flags[head] & TRAIL_VALID)) {
+        newer = 1;
+        newer_x = trail->lead_x - x0; newer_y = trail->lead_y - y0;
+        newer_row = (trail->flags[head] & TRAIL_CLICKED) ? 1 : 0;
+        trail_dot(cr, sprites, damage, paint, newer_x, newer_y, 1.0, newer_row, width, height);
+    }
+
+    for (unsigned int i = 0; i < visible; ++i) {
+        unsigned int current_index = (trail->head - 1 - i) & trail->mask;
+        uint8_t flags = trail->flags[current_index];
+
+        if (!(flags & TRAIL_VALID)) continue;
+        if (!trail_coalesce(trail, current_index, &last)) {
+            coalesced++;
+            continue;
+        }
+
+        double alpha = 1.0 - ((double)i / trail->length);
+        int row = (flags & TRAIL_CLICKED) ? 1 : 0;
+        int px = trail->x[current_index] - x0, py = trail->y[current_index] - y0;
+        if (newer) {
+            int steps = trail_segment_steps(trail, newer_x - px, newer_y - py);
+            for (int k = 1; k < steps; ++k) {
+                double t = (double)k / steps;
+                // Red only between two clicked points
+                trail_dot(cr, sprites, damage, paint,
+                          px + (int)lround((newer_x - px) * t), py + (int)lround((newer_y - py) * t),
+                          alpha + (newer_alpha - alpha) * t, row & newer_row, width, height);
+            }
+        }
+        trail_dot(cr, sprites, damage, paint, px, py, alpha, row, width, height);
+        newer = 1;
+        newer_x = px; newer_y = py; newer_row = row; newer_alpha = alpha;
+    }
+    return coalesced;
+}
+
+// Function to draw the trail onto the Cairo surface, whose top-left corner
+// is at (x0, y0) on the root window.
+// Only the area covered by the previous frame (*drawn on entry) and by this
+// frame is cleared and repainted; *drawn is updated to this frame's area.
+void draw_trail(cairo_t *cr, const Trail *trail, const SpriteAtlas *sprites,
+                Damage *drawn, int x0, int y0, int width, int height) {
+    Damage current;
+    current.count = 0;
+    trail_walk(cr, trail, sprites, &current, 0, x0, y0, width, height);
+
+    if (drawn->count == 0 && current.count == 0) return; // Nothing on screen, nothing to draw
+
+    // 1. Clip to old + new dots, then clear that area to fully transparent
+    cairo_save(cr);
+    cairo_new_path(cr);
+    damage_path(cr, drawn);
+    damage_path(cr, &current);
+    cairo_clip(cr);
+
+    cairo_set_source_rgba(cr, 0, 0, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    // 2. Draw the trail points (the same ones that were added to 'current')
+    unsigned long coalesced = trail_walk(cr, trail, sprites, NULL, 1, x0, y0, width, height);
+    cairo_restore(cr);
+    atomic_fetch_add_explicit(&stats.coalesced, coalesced, memory_order_relaxed);
+
+    *drawn = current;
+}
+
+// Append a pointer sample to the trail.
+// Returns 0 if the trail looks exactly as before (every point has collapsed
+// onto the same spot), so there is nothing to redraw.
+int trail_push(Trail *trail, const Sample *sample) {
+    unsigned int prev = (trail->head - 1) & trail->mask;
+    unsigned int slot = trail->head & trail->mask;
+    uint8_t flags = TRAIL_VALID | ((sample->mask & BUTTON_MASK_ANY) ? TRAIL_CLICKED : 0);
+    int16_t x = clamp_i16(sample->x), y = clamp_i16(sample->y);
+
+    if (trail->flags[prev] == flags && trail->x[prev] == x && trail->y[prev] == y) {
+        if (trail->unchanged < trail->length) trail->unchanged++;
+    } else {
+        trail->unchanged = 0;
+    }
+
+    trail->x[slot] = x;
+    trail->y[slot] = y;
+    trail->flags[slot] = flags;
+
+    trail->head++; // Move head
+    return trail->unchanged < trail->length;
+}
+
+// --- Sample Ring ---
+
+int ring_init(SampleRing *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->consumer_waiting, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return ring->wake_fd < 0 ? -1 : 0;
+}
+
+// Producer side. Returns 0 if the sample was dropped because the queue is full.
+int ring_push(SampleRing *ring, const Sample *sample) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail == SAMPLE_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats.dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+    ring->slots[head & (SAMPLE_RING_SIZE - 1)] = *sample;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // Pairs with the fence in ring_wait: either the consumer sees the new
+    // head before sleeping, or we see it waiting and wake it up
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumer_waiting, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(ring->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("write(eventfd)");
+        }
+    }
+    return 1;
+}
+
+// Producer side, for sources that must not lose samples (replay): waits
+// for room instead of dropping. Returns 0 if stopped while waiting.
+int ring_push_wait(SampleRing *ring, const Sample *sample) {
+    for (;;) {
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) < SAMPLE_RING_SIZE) break;
+        if (!keep_running) return 0;
+        sleep_until_ns(now_ns(CLOCK_MONOTONIC) + 100000); // The consumer is busy; give it 0.1 ms
+    }
+    return ring_push(ring, sample);
+}
+
+// Consumer side. Returns 0 if the queue is empty.
+int ring_pop(SampleRing *ring, Sample *sample) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) return 0;
+    *sample = ring->slots[tail & (SAMPLE_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+// Consumer side: sleep until the producer pushes something, extra_fd (if not
+// -1) becomes readable, a signal in sigmask's complement arrives, or timeout
+// (NULL = forever) expires. Costs no syscall if samples are already queued.
+// (The render loop waits on several rings at once with loop_wait.)
+void ring_wait(SampleRing *ring, int extra_fd, const struct timespec *timeout, const sigset_t *sigmask) {
+    atomic_store_explicit(&ring->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        struct pollfd pfd[2] = { { ring->wake_fd, POLLIN, 0 }, { extra_fd, POLLIN, 0 } };
+        if (ppoll(pfd, extra_fd >= 0 ? 2 : 1, timeout, sigmask) > 0 && (pfd[0].revents & POLLIN)) {
+            uint64_t count;
+            if (read(ring->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("read(eventfd)");
+            }
+        }
+    }
+    atomic_store_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+}
+
+// --- X Error Traps ---
+
+// Some X errors are expected: a window or device can go away between
+// hearing of it and asking about it. The error handler is process-wide, so
+// a thread brackets such requests with x_trap_begin/x_trap_end. An error
+// with one of the trap's codes, on the trap's connection, from a request
+// made since x_trap_begin, is recorded in the trap. Anything else goes to
+// Xlib's default handler (which exits).
+typedef struct {
+    Display *display;
+    unsigned long serial;   // First request covered
+    unsigned char codes[2]; // Error codes expected, 0 for none
+    int error;              // Error code caught, 0 if none
+} XErrorTrap;
+
+int (*default_x_error_handler)(Display *, XErrorEvent *);
+_Thread_local XErrorTrap *x_error_trap; // The calling thread's open trap
+pthread_once_t x_error_once = PTHREAD_ONCE_INIT;
+
+int x_error_handler(Display *display, XErrorEvent *err) {
+    XErrorTrap *trap = x_error_trap;
+    if (trap && display == trap->display && err->serial >= trap->serial &&
+        (err->error_code == trap->codes[0] || err->error_code == trap->codes[1])) {
+        trap->error = err->error_code;
+        return 0;
+    }
+    return default_x_error_handler(display, err);
+}
+
+void x_error_install(void) {
+    default_x_error_handler = XSetErrorHandler(x_error_handler);
+}
+
+void x_trap_begin(XErrorTrap *trap, Display *display, int code, int other_code) {
+    pthread_once(&x_error_once, x_error_install);
+    *trap = (XErrorTrap){ .display = display, .serial = NextRequest(display),
+                          .codes = { (unsigned char)code, (unsigned char)other_code } };
+    x_error_trap = trap;
+}
+
+// Close the trap. Its last request must have a reply (or be followed by an
+// XSync) for every error to be in. Returns the error code caught, 0 if none.
+int x_trap_end(XErrorTrap *trap) {
+    x_error_trap = NULL;
+    return trap->error;
+}
+
+// --- Window Attribution ---
+
+// Open the cache's own connection to display_name (NULL: $DISPLAY).
+// Returns 0 on success, -1 on error.
+int window_cache_init(WindowCache *cache, const char *display_name, int format) {
+    memset(cache, 0, sizeof(*cache));
+    cache->format = format;
+    cache->display = XOpenDisplay(display_name);
+    if (!cache->display) {
+        fprintf(stderr, "Warning: Could not open X display %s for window attribution.\n",
+                XDisplayName(display_name));
+        return -1;
+    }
+    // One round trip for all three
+    char *names[] = { "WM_STATE", "_NET_WM_NAME", "UTF8_STRING" };
+    Atom atoms[3];
+    XInternAtoms(cache->display, names, 3, False, atoms);
+    cache->wm_state = atoms[0];
+    cache->net_wm_name = atoms[1];
+    cache->utf8_string = atoms[2];
+    return 0;
+}
+
+void window_cache_free(WindowCache *cache) {
+    if (cache->display) XCloseDisplay(cache->display);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Append s to out (size left: *left) escaped for the log format
+void window_escape(char **out, size_t *left, const char *s, int format) {
+    for (; *s && *left > 7; ++s) {
+        unsigned char c = (unsigned char)*s;
+        int n;
+        if (format == LOG_JSON && (c == '"' || c == '\\')) {
+            n = snprintf(*out, *left, "\\%c", c);
+        } else if (format == LOG_JSON && c < 0x20) {
+            n = snprintf(*out, *left, "\\u%04x", c);
+        } else if (format == LOG_CSV && c == '"') {
+            n = snprintf(*out, *left, "\"\"");
+        } else if (c < 0x20) {
+            n = snprintf(*out, *left, " "); // No line breaks in any format
+        } else {
+            **out = (char)c; (*out)[1] = '\0'; n = 1;
+        }
+        *out += n; *left -= (size_t)n;
+    }
+}
+
+// Find the application window under a top-level window: the one with
+// WM_STATE, normally a child of the window manager's frame
+Window window_find_client(WindowCache *cache, Window window, int depth) {
+    Atom type;
+    int format;
+    unsigned long nitems, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(cache->display, window, cache->wm_state, 0, 0, False, AnyPropertyType,
+                           &type, &format, &nitems, &after, &data) == Success) {
+        if (data) XFree(data);
+        if (type != None) return window;
+    }
+    if (depth == 0) return None;
+
+    Window root, parent, *children = NULL, found = None;
+    unsigned int count = 0;
+    if (XQueryTree(cache->display, window, &root, &parent, &children, &count)) {
+        for (unsigned int i = count; i-- > 0 && found == None;) { // Topmost first
+            found = window_find_client(cache, children[i], depth - 1);
+        }
+        if (children) XFree(children);
+    }
+    return found;
+}
+
+// Look the window up on the server and format its field. BadWindow is
+// expected: a window can vanish between the sample and the lookup.
+void window_fetch(WindowCache *cache, WindowInfo *info) {
+    char wm_class[WINDOW_CLASS_MAX] = "", title[WINDOW_TITLE_MAX] = "";
+
+    XErrorTrap trap;
+    x_trap_begin(&trap, cache->display, BadWindow, BadDrawable);
+    if (!info->client) {
+        info->client = window_find_client(cache, info->window, 3);
+        if (!info->client) info->client = info->window; // Override-redirect, no WM, ...
+        // Follow title changes and learn when the window goes away
+        XSelectInput(cache->display, info->client, PropertyChangeMask);
+        if (info->client != info->window) XSelectInput(cache->display, info->window, StructureNotifyMask);
+        else XSelectInput(cache->display, info->window, PropertyChangeMask | StructureNotifyMask);
+    }
+
+    XClassHint hint = { NULL, NULL };
+    if (XGetClassHint(cache->display, info->client, &hint)) {
+        snprintf(wm_class, sizeof(wm_class), "%s", hint.res_class ? hint.res_class : "");
+        if (hint.res_name) XFree(hint.res_name);
+        if (hint.res_class) XFree(hint.res_class);
+    }
+
+    // _NET_WM_NAME (UTF-8) first, WM_NAME for older clients
+    Atom type;
+    int format;
+    unsigned long nitems, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(cache->display, info->client, cache->net_wm_name, 0, WINDOW_TITLE_MAX / 4, False,
+                           cache->utf8_string, &type, &format, &nitems, &after, &data) == Success &&
+        data && type == cache->utf8_string && format == 8) {
+        snprintf(title, sizeof(title), "%.*s", (int)nitems, (char *)data);
+        // Don't leave half a UTF-8 sequence where the property was cut off
+        size_t len = strlen(title), start = len;
+        while (start > 0 && ((unsigned char)title[start - 1] & 0xc0) == 0x80) start--;
+        if (start > 0 && (unsigned char)title[start - 1] >= 0xc0) {
+            unsigned char lead = (unsigned char)title[start - 1];
+            size_t need = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : 2;
+            if (len - (start - 1) < need) title[start - 1] = '\0';
+        }
+    } else {
+        char *name = NULL;
+        if (XFetchName(cache->display, info->client, &name) && name) {
+            snprintf(title, sizeof(title), "%s", name);
+            XFree(name);
+        }
+    }
+    if (data) XFree(data);
+    int vanished = x_trap_end(&trap) != 0; // The lookups above all waited for replies
+
+    char *out = info->field;
+    size_t left = sizeof(info->field);
+    if (cache->format == LOG_CSV) {
+        *out++ = ','; *out++ = '"'; left -= 2;
+        window_escape(&out, &left, wm_class, LOG_CSV);
+        *out++ = '"'; *out++ = ','; *out++ = '"'; left -= 3;
+        window_escape(&out, &left, title, LOG_CSV);
+        *out++ = '"'; *out = '\0';
+    } else if (cache->format == LOG_JSON) {
+        int n = snprintf(out, left, ",\"class\":\"");
+        out += n; left -= (size_t)n;
+        window_escape(&out, &left, wm_class, LOG_JSON);
+        n = snprintf(out, left, "\",\"title\":\"");
+        out += n; left -= (size_t)n;
+        window_escape(&out, &left, title, LOG_JSON);
+        snprintf(out, left, "\"");
+    } else {
+        snprintf(out, left, " [%s]", wm_class);
+    }
+    info->stale = vanished; // Went away mid-lookup: try again next time
+}
+
+// The formatted log field for a root child window. A hash lookup unless
+// the window is new or has changed.
+const char *window_cache_field(WindowCache *cache, Window window) {
+    static const char *empty[] = { ",\"\",\"\"", ",\"class\":\"\",\"title\":\"\"", "" };
+    if (window == None) {
+        return cache->format == LOG_CSV ? empty[0] : cache->format == LOG_JSON ? empty[1] : empty[2];
+    }
+
+    unsigned int i = (unsigned int)((window * 0x9e3779b97f4a7c15ull) >> 32) & (WINDOW_CACHE_SIZE - 1);
+    while (cache->slots[i].window != None && cache->slots[i].window != window) {
+        i = (i + 1) & (WINDOW_CACHE_SIZE - 1);
+    }
+    WindowInfo *info = &cache->slots[i];
+    if (info->window == window && !info->stale) {
+        cache->hits++;
+        return info->field;
+    }
+
+    cache->misses++;
+    if (info->window == None) {
+        if (cache->used >= WINDOW_CACHE_SIZE * 3 / 4) {
+            // Full of windows long gone: start over
+            memset(cache->slots, 0, sizeof(cache->slots));
+            cache->used = 0;
+            return window_cache_field(cache, window);
+        }
+        info->window = window;
+        info->client = None;
+        cache->used++;
+    }
+    window_fetch(cache, info);
+    return info->field;
+}
+
+// Apply PropertyNotify/DestroyNotify events: mark the affected entries
+// stale. Never blocks; called once per batch of samples.
+void window_cache_handle_events(WindowCache *cache) {
+    while (XEventsQueued(cache->display, QueuedAfterReading)) {
+        XEvent ev;
+        XNextEvent(cache->display, &ev);
+        Window w;
+        if (ev.type == PropertyNotify) {
+            if (ev.xproperty.atom != XA_WM_NAME && ev.xproperty.atom != XA_WM_CLASS &&
+                ev.xproperty.atom != cache->net_wm_name) continue;
+            w = ev.xproperty.window;
+        } else if (ev.type == DestroyNotify) {
+            w = ev.xdestroywindow.window;
+        } else {
+            continue;
+        }
+        // Events are rare next to samples; a scan is fine
+        for (unsigned int i = 0; i < WINDOW_CACHE_SIZE; ++i) {
+            WindowInfo *info = &cache->slots[i];
+            if (info->window != None && (info->window == w || info->client == w)) {
+                info->stale = 1;
+                if (ev.type == DestroyNotify) info->client = None; // Window IDs get reused
+            }
+        }
+    }
+}
+
+// --- Logger ---
+
+void logger_init(Logger *log, int fd, int format) {
+    log->fd = fd;
+    log->format = format;
+    log->windows = NULL;
+    log->sources = 0;
+    log->len = 0;
+    log->pending_since_ns = 0;
+    log->have_last = 0;
+}
+
+// Write out everything buffered. Blocks if stdout does, which only ever
+// holds up the render thread.
+void logger_flush(Logger *log) {
+    size_t off = 0;
+    while (off < log->len) {
+        ssize_t n = write(log->fd, log->buf + off, log->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE) {
+                keep_running = 0; // Reader went away (e.g. "| head"); stop like any filter
+            } else {
+                perror("write(log)");
+            }
+            break;
+        }
+        off += (size_t)n;
+    }
+    log->len = 0;
+    log->pending_since_ns = 0;
+}
+
+// Append formatted text, flushing first if it might not fit
+void logger_printf(Logger *log, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void logger_printf(Logger *log, const char *fmt, ...) {
+    if (LOG_BUFFER_SIZE - log->len < LOG_LINE_MAX) logger_flush(log);
+    if (log->len == 0) log->pending_since_ns = now_ns(CLOCK_MONOTONIC);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(log->buf + log->len, LOG_BUFFER_SIZE - log->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        log->len += (size_t)n < LOG_BUFFER_SIZE - log->len ? (size_t)n : LOG_BUFFER_SIZE - log->len - 1;
+    }
+}
+
+void logger_header(Logger *log) {
+    if (log->format == LOG_CSV) {
+        logger_printf(log, "time_ns,x,y,mask,child%s%s\n", log->sources ? ",seat,pointer" : "",
+                      log->windows ? ",wm_class,title" : "");
+    }
+    if (log->format == LOG_STATUS) logger_printf(log, "\rMouse Coordinates: X=     Y=     ");
+    logger_flush(log);
+}
+
+void logger_sample(Logger *log, const Sample *sample) {
+    const char *window = "";
+    char source[32] = "";
+    switch (log->format) {
+    case LOG_CSV:
+        if (log->windows) window = window_cache_field(log->windows[sample->seat], sample->child);
+        if (log->sources) snprintf(source, sizeof(source), ",%u,%u", sample->seat, sample->pointer);
+        logger_printf(log, "%llu,%d,%d,%u,%lu%s%s\n", (unsigned long long)sample->time_ns,
+                      sample->x, sample->y, sample->mask, (unsigned long)sample->child, source, window);
+        break;
+    case LOG_JSON:
+        if (log->windows) window = window_cache_field(log->windows[sample->seat], sample->child);
+        if (log->sources) {
+            snprintf(source, sizeof(source), ",\"seat\":%u,\"pointer\":%u", sample->seat, sample->pointer);
+        }
+        logger_printf(log, "{\"t\":%llu,\"x\":%d,\"y\":%d,\"mask\":%u,\"child\":%lu%s%s}\n",
+                      (unsigned long long)sample->time_ns,
+                      sample->x, sample->y, sample->mask, (unsigned long)sample->child, source, window);
+        break;
+    default:
+        // The status line overwrites itself, so only the newest sample matters
+        log->last = *sample;
+        log->have_last = 1;
+        break;
+    }
+}
+
+// Called once per batch of samples. The status line is redrawn right away;
+// line formats are written when the buffer is large or old enough.
+void logger_batch_end(Logger *log) {
+    if (log->format == LOG_STATUS) {
+        if (!log->have_last) return;
+        logger_printf(log, "\rMouse Coordinates: X=%-5d Y=%-5d", log->last.x, log->last.y);
+        if (log->sources) logger_printf(log, " (%u.%-2u)", log->last.seat, log->last.pointer);
+        if (log->windows) {
+            // Padded so a shorter name overwrites a longer one
+            logger_printf(log, "%-40s", window_cache_field(log->windows[log->last.seat], log->last.child));
+        }
+        log->have_last = 0;
+        logger_flush(log);
+        return;
+    }
+    if (log->len && now_ns(CLOCK_MONOTONIC) - log->pending_since_ns >= LOG_FLUSH_MS * 1000000ull) {
+        logger_flush(log);
+    }
+}
+
+// When buffered lines are due (CLOCK_MONOTONIC ns), for the render
+// thread's timer. Returns 0 if nothing is buffered.
+uint64_t logger_deadline(const Logger *log) {
+    return log->len ? log->pending_since_ns + LOG_FLUSH_MS * 1000000ull : 0;
+}
+
+// --- Packed Trace Encoding ---
+// Stream VByte (see "Trace File Format"): byte lengths are in separate
+// control bytes, so a decoder never branches on the data. The SIMD
+// decoders turn one control byte into a pshufb mask that spreads four
+// values' bytes out to four 32-bit lanes, then undo zigzag and delta
+// in-register.
+
+unsigned char svb_length[256];              // Data bytes of a control byte's four values
+_Alignas(16) unsigned char svb_shuffle[256][16]; // pshufb mask for it, 0x80 = zero
+// Decode n values of the stream at in (size bytes) into out; with 'delta',
+// undo zigzag and delta coding too. Returns the stream's length, or
+// SIZE_MAX if it is damaged. Picked by svb_init for this CPU.
+size_t (*svb_decode)(const unsigned char *in, size_t size, uint32_t n, uint32_t *out, int delta);
+
+static inline unsigned int svb_value_length(uint32_t v) {
+    return v < (1u << 8) ? 1 : v < (1u << 16) ? 2 : v < (1u << 24) ? 3 : 4;
+}
+
+static inline uint32_t svb_zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// Encode n values into out. Returns the bytes written.
+size_t svb_encode(const uint32_t *values, uint32_t n, unsigned char *out) {
+    unsigned char *ctrl = out, *data = out + (n + 3) / 4;
+    memset(ctrl, 0, (n + 3) / 4);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t v = values[i];
+        unsigned int len = svb_value_length(v);
+        ctrl[i / 4] |= (unsigned char)((len - 1) << (2 * (i % 4)));
+        for (unsigned int b = 0; b < len; ++b) *data++ = (unsigned char)(v >> (8 * b));
+    }
+    return (size_t)(data - out);
+}
+
+// Decode values [i, n) from control bytes ctrl and data, continuing a delta
+// run from 'prev'. Returns the end of the data, or NULL past 'end'.
+static const unsigned char *svb_decode_from(const unsigned char *ctrl, const unsigned char *data,
+                                            const unsigned char *end, uint32_t i, uint32_t n,
+                                            uint32_t *out, int delta, uint32_t prev) {
+    for (; i < n; ++i) {
+        unsigned int len = ((ctrl[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        if ((size_t)(end - data) < len) return NULL;
+        uint32_t v = 0;
+        for (unsigned int b = 0; b < len; ++b) v |= (uint32_t)data[b] << (8 * b);
+        data += len;
+        if (delta) v = prev += (v >> 1) ^ (0u - (v & 1));
+        out[i] = v;
+    }
+    return data;
+}
+
+size_t svb_decode_scalar(const unsigned char *in, size_t size, uint32_t n, uint32_t *out, int delta) {
+    size_t ctrl_len = ((size_t)n + 3) / 4;
+    if (ctrl_len > size) return SIZE_MAX;
+    const unsigned char *end = svb_decode_from(in, in + ctrl_len, in + size, 0, n, out, delta, 0);
+    return end ? (size_t)(end - in) : SIZE_MAX;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Four values per control byte. Each load reads 16 bytes, so the last few
+// values (within 16 bytes of the end) are left to svb_decode_from.
+__attribute__((target("sse4.1")))
+size_t svb_decode_sse41(const unsigned char *in, size_t size, uint32_t n, uint32_t *out, int delta) {
+    size_t ctrl_len = ((size_t)n + 3) / 4;
+    if (ctrl_len > size) return SIZE_MAX;
+    const unsigned char *data = in + ctrl_len, *end = in + size;
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i prev = _mm_setzero_si128(); // Last value so far, in every lane
+    uint32_t i = 0;
+    for (; i + 4 <= n && end - data >= 16; i += 4) {
+        unsigned int c = in[i / 4];
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data),
+                                     _mm_load_si128((const __m128i *)svb_shuffle[c]));
+        data += svb_length[c];
+        if (delta) {
+            v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4)); // Prefix sum across the lanes
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi32(v, prev);
+            prev = _mm_shuffle_epi32(v, 0xff);
+        }
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+    end = svb_decode_from(in, data, end, i, n, out, delta, (uint32_t)_mm_cvtsi128_si32(prev));
+    return end ? (size_t)(end - in) : SIZE_MAX;
+}
+
+// Eight values (two control bytes) per step, one 128-bit lane each
+__attribute__((target("avx2")))
+size_t svb_decode_avx2(const unsigned char *in, size_t size, uint32_t n, uint32_t *out, int delta) {
+    size_t ctrl_len = ((size_t)n + 3) / 4;
+    if (ctrl_len > size) return SIZE_MAX;
+    const unsigned char *data = in + ctrl_len, *end = in + size;
+    const __m256i one = _mm256_set1_epi32(1), last = _mm256_set1_epi32(7);
+    __m256i prev = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 8 <= n && end - data >= 32; i += 8) {
+        unsigned int c0 = in[i / 4], c1 = in[i / 4 + 1];
+        __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data),
+                                      _mm_load_si128((const __m128i *)svb_shuffle[c0]));
+        data += svb_length[c0];
+        __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data),
+                                      _mm_load_si128((const __m128i *)svb_shuffle[c1]));
+        data += svb_length[c1];
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        if (delta) {
+            v = _mm256_xor_si256(_mm256_srli_epi32(v, 1),
+                                 _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(v, one)));
+            v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4)); // Prefix sums within each lane...
+            v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+            __m256i carry = _mm256_shuffle_epi32(v, 0xff);     // ... then lane 0's total into lane 1
+            v = _mm256_add_epi32(v, _mm256_permute2x128_si256(carry, carry, 0x08));
+            v = _mm256_add_epi32(v, prev);
+            prev = _mm256_permutevar8x32_epi32(v, last);
+        }
+        _mm256_storeu_si256((__m256i *)(out + i), v);
+    }
+    end = svb_decode_from(in, data, end, i, n, out, delta, (uint32_t)_mm256_cvtsi256_si32(prev));
+    return end ? (size_t)(end - in) : SIZE_MAX;
+}
+#endif
+
+// Build the decoding tables and pick the fastest decoder the CPU has
+void svb_init(void) {
+    if (svb_decode) return;
+    for (unsigned int c = 0; c < 256; ++c) {
+        unsigned int offset = 0;
+        for (unsigned int lane = 0; lane < 4; ++lane) {
+            unsigned int len = ((c >> (2 * lane)) & 3) + 1;
+            for (unsigned int b = 0; b < 4; ++b) {
+                svb_shuffle[c][4 * lane + b] = b < len ? (unsigned char)(offset + b) : 0x80;
+            }
+            offset += len;
+        }
+        svb_length[c] = (unsigned char)offset;
+    }
+    svb_decode = svb_decode_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) svb_decode = svb_decode_avx2;
+    else if (__builtin_cpu_supports("sse4.1")) svb_decode = svb_decode_sse41;
+#endif
+}
+
+static inline uint64_t trace_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+// Decode a packed chunk ('available' bytes after its index block) into
+// records[]; 'columns' is scratch for 3 * TRACE_PACKED_RECORDS values.
+// Returns the number of records, 0 if the chunk is damaged.
+unsigned int trace_unpack_chunk(const TraceIndexBlock *index, size_t available,
+                                TraceRecord *records, uint32_t *columns) {
+    uint32_t n = index->count;
+    if (n == 0 || n > TRACE_PACKED_RECORDS) return 0;
+    const unsigned char *base = (const unsigned char *)(index + 1), *p = base;
+    for (int s = 0; s < 3; ++s) {
+        size_t size = index->stream_size[s];
+        if (size > available - (size_t)(p - base) ||
+            svb_decode(p, size, n, columns + (size_t)s * TRACE_PACKED_RECORDS, s > 0) != size) {
+            return 0;
+        }
+        p += size;
+    }
+    size_t offset = ((size_t)(p - base) + 7) & ~(size_t)7;
+    if (offset > available || (available - offset) / sizeof(TraceEvent) < index->events) return 0;
+    const TraceEvent *events = (const TraceEvent *)(base + offset);
+
+    // One pass to add up the time deltas and interleave the columns
+    const uint32_t *dt = columns, *xs = columns + TRACE_PACKED_RECORDS, *ys = xs + TRACE_PACKED_RECORDS;
+    uint64_t time = index->first_time_ns;
+    uint32_t mask = 0, child = 0, e = 0;
+    uint32_t next = index->events ? events[0].record : UINT32_MAX;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t zz = dt[i];
+        while (next == i) {
+            const TraceEvent *ev = &events[e++];
+            if (ev->field == TRACE_EVENT_MASK) mask = (uint32_t)ev->value;
+            else if (ev->field == TRACE_EVENT_CHILD) child = (uint32_t)ev->value;
+            else if (ev->field == TRACE_EVENT_TIME_HIGH) zz |= ev->value << 32;
+            next = e < index->events ? events[e].record : UINT32_MAX;
+        }
+        time += (zz >> 1) ^ (0 - (zz & 1));
+        records[i] = (TraceRecord){ .time_ns = time, .x = (int32_t)xs[i], .y = (int32_t)ys[i],
+                                    .mask = mask, .child = child };
+    }
+    return n;
+}
+
+// --- Trace Recording ---
+
+// Map the window of chunks starting at chunk 'first', growing the file to
+// cover it. The space is allocated up front: a sparse file would report a
+// full disk as SIGBUS on some later store. On failure the old window stays
+// mapped, so index/records still point at the last chunk written.
+int trace_map_window(TraceWriter *tw, uint64_t first) {
+    off_t offset = TRACE_HEADER_SIZE + (off_t)first * TRACE_CHUNK_SIZE;
+    size_t length = (size_t)TRACE_MAP_CHUNKS * TRACE_CHUNK_SIZE;
+    int err = posix_fallocate(tw->fd, offset, (off_t)length);
+    if (err != 0) {
+        fprintf(stderr, "Error: Could not grow the trace file: %s\n", strerror(err));
+        return -1;
+    }
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, tw->fd, offset);
+    if (map == MAP_FAILED) {
+        perror("mmap(trace)");
+        return -1;
+    }
+    if (tw->window) munmap(tw->window, length);
+    tw->window = map;
+    tw->window_first = first;
+    return 0;
+}
+
+// Start a new chunk and write its index block
+int trace_start_chunk(TraceWriter *tw, uint64_t first_time_ns) {
+    uint64_t chunk = tw->header->chunk_count;
+    if (!tw->window || chunk >= tw->window_first + TRACE_MAP_CHUNKS) {
+        if (trace_map_window(tw, chunk) != 0) return -1;
+    }
+    unsigned char *base = tw->window + (chunk - tw->window_first) * TRACE_CHUNK_SIZE;
+    tw->index = (TraceIndexBlock *)base;
+    tw->records = (TraceRecord *)(base + sizeof(TraceIndexBlock));
+
+    memset(tw->index, 0, sizeof(*tw->index));
+    tw->index->magic = TRACE_INDEX_MAGIC;
+    tw->index->chunk = chunk;
+    tw->index->first_record = tw->header->record_count;
+    tw->index->first_time_ns = first_time_ns;
+    tw->header->chunk_count = chunk + 1;
+    return 0;
+}
+
+// Create (or truncate) a trace file, raw or packed. Returns 0 on success,
+// -1 on error.
+int trace_open(TraceWriter *tw, const char *path, int width, int height, int packed) {
+    memset(tw, 0, sizeof(*tw));
+    if (packed) {
+        tw->packed = 1;
+        tw->pending = malloc(TRACE_PACKED_RECORDS * sizeof(TraceRecord));
+        tw->columns = malloc(3 * TRACE_PACKED_RECORDS * sizeof(uint32_t));
+        if (!tw->pending || !tw->columns) {
+            fprintf(stderr, "Error: Could not allocate the trace encoder\n");
+            free(tw->pending); free(tw->columns); return -1;
+        }
+    }
+    tw->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (tw->fd < 0) {
+        fprintf(stderr, "Error: Could not create trace file %s: %s\n", path, strerror(errno));
+        free(tw->pending); free(tw->columns); return -1;
+    }
+    if (ftruncate(tw->fd, TRACE_HEADER_SIZE) != 0) {
+        perror("ftruncate(trace)");
+        close(tw->fd); free(tw->pending); free(tw->columns); return -1;
+    }
+    void *map = mmap(NULL, TRACE_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, tw->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap(trace)");
+        close(tw->fd); free(tw->pending); free(tw->columns); return -1;
+    }
+    tw->header = map;
+    memcpy(tw->header->magic, TRACE_MAGIC, sizeof(tw->header->magic));
+    tw->header->version = packed ? TRACE_VERSION_ENCODING : TRACE_VERSION;
+    tw->header->encoding = packed ? TRACE_ENCODING_PACKED : TRACE_ENCODING_RAW;
+    tw->header->header_size = TRACE_HEADER_SIZE;
+    tw->header->chunk_size = TRACE_CHUNK_SIZE;
+    tw->header->record_size = sizeof(TraceRecord);
+    tw->header->records_per_chunk = packed ? TRACE_PACKED_RECORDS : TRACE_CHUNK_RECORDS;
+    tw->header->screen_width = width;
+    tw->header->screen_height = height;
+    tw->header->start_monotonic_ns = now_ns(CLOCK_MONOTONIC);
+    tw->header->start_realtime_ns = now_ns(CLOCK_REALTIME);
+    return 0;
+}
+
+// Packed traces: encode the pending records into a new chunk
+int trace_pack(TraceWriter *tw) {
+    unsigned int n = tw->pending_count;
+    if (n == 0) return 0;
+    const TraceRecord *rec = tw->pending;
+    if (trace_start_chunk(tw, rec[0].time_ns) != 0) return -1;
+
+    uint32_t *dt = tw->columns, *xs = dt + TRACE_PACKED_RECORDS, *ys = xs + TRACE_PACKED_RECORDS;
+    unsigned int nevents = 0;
+    TraceRecord prev = { .time_ns = rec[0].time_ns };
+    for (unsigned int i = 0; i < n; ++i) {
+        uint64_t zz = trace_zigzag((int64_t)(rec[i].time_ns - prev.time_ns));
+        dt[i] = (uint32_t)zz;
+        xs[i] = svb_zigzag((int32_t)((uint32_t)rec[i].x - (uint32_t)prev.x));
+        ys[i] = svb_zigzag((int32_t)((uint32_t)rec[i].y - (uint32_t)prev.y));
+        prev = rec[i];
+    }
+
+    unsigned char *base = (unsigned char *)(tw->index + 1), *p = base;
+    for (int s = 0; s < 3; ++s) {
+        size_t size = svb_encode(tw->columns + (size_t)s * TRACE_PACKED_RECORDS, n, p);
+        tw->index->stream_size[s] = (uint32_t)size;
+        p += size;
+    }
+    size_t offset = ((size_t)(p - base) + 7) & ~(size_t)7;
+    memset(p, 0, offset - (size_t)(p - base));
+
+    // Events, in record order
+    TraceEvent *out = (TraceEvent *)(base + offset);
+    prev = (TraceRecord){ .time_ns = rec[0].time_ns };
+    for (unsigned int i = 0; i < n; ++i) {
+        uint64_t zz = trace_zigzag((int64_t)(rec[i].time_ns - prev.time_ns));
+        if (rec[i].mask != prev.mask) out[nevents++] = (TraceEvent){ i, TRACE_EVENT_MASK, rec[i].mask };
+        if (rec[i].child != prev.child) out[nevents++] = (TraceEvent){ i, TRACE_EVENT_CHILD, rec[i].child };
+        if (zz >> 32) out[nevents++] = (TraceEvent){ i, TRACE_EVENT_TIME_HIGH, zz >> 32 };
+        prev = rec[i];
+    }
+
+    tw->index->events = nevents;
+    tw->index->count = n;
+    tw->index->last_time_ns = rec[n - 1].time_ns;
+    tw->header->record_count += n;
+    tw->chunk_used = sizeof(TraceIndexBlock) + offset + nevents * sizeof(TraceEvent);
+    tw->pending_count = 0;
+    tw->pending_events = 0;
+    tw->pending_size = 0;
+    return 0;
+}
+
+// Packed traces: queue a record, packing the chunk first if it would not fit.
+// Only the bytes it adds are worked out here; encoding waits for trace_pack.
+int trace_append_packed(TraceWriter *tw, const TraceRecord *record) {
+    const TraceRecord *prev = tw->pending_count ? &tw->pending[tw->pending_count - 1] : NULL;
+    TraceRecord first = { .time_ns = record->time_ns };
+    if (!prev) prev = &first;
+
+    uint64_t zz = trace_zigzag((int64_t)(record->time_ns - prev->time_ns));
+    unsigned int events = (record->mask != prev->mask) + (record->child != prev->child) + (zz >> 32 != 0);
+    size_t bytes = svb_value_length((uint32_t)zz) +
+                   svb_value_length(svb_zigzag((int32_t)((uint32_t)record->x - (uint32_t)prev->x))) +
+                   svb_value_length(svb_zigzag((int32_t)((uint32_t)record->y - (uint32_t)prev->y))) +
+                   events * sizeof(TraceEvent);
+    if (tw->pending_count % 4 == 0) bytes += 3; // Control bytes
+    // 7: worst-case padding before the events
+    if (tw->pending_size + bytes + 7 > TRACE_CHUNK_SIZE || tw->pending_count == TRACE_PACKED_RECORDS) {
+        if (trace_pack(tw) != 0) return -1;
+        return trace_append_packed(tw, record); // Now first in a fresh chunk
+    }
+    if (tw->pending_count == 0) tw->pending_size = sizeof(TraceIndexBlock);
+    tw->pending[tw->pending_count++] = *record;
+    tw->pending_events += events;
+    tw->pending_size += bytes;
+    return 0;
+}
+
+// Append one sample. A memory store in the common case.
+int trace_append(TraceWriter *tw, const Sample *sample) {
+    if (tw->packed) {
+        TraceRecord record = { .time_ns = sample->time_ns, .x = sample->x, .y = sample->y,
+                               .mask = sample->mask | (uint32_t)sample->pointer << MASK_POINTER_SHIFT,
+                               .child = (uint32_t)sample->child };
+        return trace_append_packed(tw, &record);
+    }
+    if (!tw->index || tw->index->count == TRACE_CHUNK_RECORDS) {
+        if (trace_start_chunk(tw, sample->time_ns) != 0) return -1;
+    }
+    TraceRecord *record = &tw->records[tw->index->count];
+    record->time_ns = sample->time_ns;
+    record->x = sample->x;
+    record->y = sample->y;
+    record->mask = sample->mask | (uint32_t)sample->pointer << MASK_POINTER_SHIFT;
+    record->child = (uint32_t)sample->child;
+
+    tw->index->last_time_ns = sample->time_ns;
+    tw->index->count++;
+    tw->header->record_count++;
+    return 0;
+}
+
+// Write out anything still held in memory (packed traces: the chunk being
+// filled), so header->record_count covers every sample appended
+void trace_flush(TraceWriter *tw) {
+    if (tw->packed && trace_pack(tw) != 0) tw->pending_count = 0;
+}
+
+// Unmap and cut the file back to the last record written
+void trace_close(TraceWriter *tw) {
+    trace_flush(tw);
+    off_t size = TRACE_HEADER_SIZE;
+    if (tw->index) {
+        size += (off_t)tw->index->chunk * TRACE_CHUNK_SIZE
+              + (tw->packed ? (off_t)tw->chunk_used
+                            : (off_t)(sizeof(TraceIndexBlock) + tw->index->count * sizeof(TraceRecord)));
+    }
+    free(tw->pending);
+    free(tw->columns);
+    if (tw->window) munmap(tw->window, (size_t)TRACE_MAP_CHUNKS * TRACE_CHUNK_SIZE);
+    if (tw->header) munmap(tw->header, TRACE_HEADER_SIZE);
+    if (tw->fd >= 0) {
+        if (ftruncate(tw->fd, size) != 0) perror("ftruncate(trace)");
+        close(tw->fd);
+    }
+    memset(tw, 0, sizeof(*tw));
+    tw->fd = -1;
+}
+
+// --- Triggered Recording ---
+
+// Parse a --trigger list such as "click,jump=300,signal" into tr.
+// Returns 0 on success, -1 on error.
+int trigger_parse(TriggerRecorder *tr, const char *spec) {
+    char *buf = strdup(spec);
+    if (!buf) {
+        perror("strdup");
+        return -1;
+    }
+    int result = 0;
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok && result == 0; tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "click") == 0) {
+            tr->triggers |= TRIGGER_CLICK;
+        } else if (strcmp(tok, "signal") == 0) {
+            tr->triggers |= TRIGGER_SIGNAL;
+        } else if (strncmp(tok, "jump", 4) == 0 && (tok[4] == '\0' || tok[4] == '=')) {
+            char *end = NULL;
+            tr->triggers |= TRIGGER_JUMP;
+            tr->jump_px = tok[4] ? strtod(tok + 5, &end) : TRIGGER_JUMP_PX;
+            if ((end && (end == tok + 5 || *end)) || !(tr->jump_px >= 1)) {
+                fprintf(stderr, "Error: Invalid jump distance '%s' (at least 1 pixel)\n", tok + 4 + (tok[4] != '\0'));
+                result = -1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown trigger '%s' (click, jump[=PX] or signal)\n", tok);
+            result = -1;
+        }
+    }
+    free(buf);
+    if (result == 0 && !tr->triggers) {
+        fprintf(stderr, "Error: --trigger needs at least one of click, jump[=PX] or signal\n");
+        result = -1;
+    }
+    return result;
+}
+
+// Allocate the pre-roll ring. Returns 0 on success, -1 on error.
+int trigger_init(TriggerRecorder *tr, double pre_roll, double post_roll) {
+    uint64_t want = (uint64_t)(pre_roll * TRIGGER_RATE_MAX), capacity = 1;
+    while (capacity < want) capacity <<= 1;
+    tr->ring = malloc(capacity * sizeof(Sample));
+    if (!tr->ring) {
+        fprintf(stderr, "Error: Could not allocate a pre-roll of %llu samples\n", (unsigned long long)capacity);
+        return -1;
+    }
+    tr->mask = capacity - 1;
+    tr->pre_roll_ns = (uint64_t)(pre_roll * 1e9);
+    tr->post_roll_ns = (uint64_t)(post_roll * 1e9);
+    tr->wake_fd = -1;
+    if ((tr->triggers & TRIGGER_SIGNAL) && (tr->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        free(tr->ring);
+        tr->ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void trigger_free(TriggerRecorder *tr) {
+    if (!tr->ring) return; // Never set up
+    if (tr->wake_fd >= 0) close(tr->wake_fd);
+    free(tr->ring);
+    tr->ring = NULL;
+}
+
+// Render thread, on SIGUSR2: note when it came in and wake the capture
+// loop, which fires the trigger at that time
+void trigger_signal(TriggerRecorder *tr) {
+    if (tr->wake_fd < 0) return;
+    atomic_store_explicit(&tr->signalled_ns, now_ns(CLOCK_MONOTONIC), memory_order_relaxed);
+    uint64_t one = 1;
+    if (write(tr->wake_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+}
+
+// Capture thread: when the pending SIGUSR2 came in, 0 if there is none.
+// Drains the eventfd before taking the time, so a signal landing in
+// between leaves it readable and is picked up on the next wakeup.
+uint64_t trigger_take_signal(TriggerRecorder *tr) {
+    if (tr->wake_fd < 0) return 0;
+    uint64_t count;
+    if (read(tr->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+    return atomic_exchange_explicit(&tr->signalled_ns, 0, memory_order_relaxed);
+}
+
+// Does 'sample' fire a trigger? Updates the per-pointer history. A
+// correction (an XI2 resync replacing an estimate) is no jump.
+int trigger_check(TriggerRecorder *tr, const Sample *sample, int correction) {
+    int fired = 0;
+    unsigned int p = sample->pointer < POINTER_MAX ? sample->pointer : 0;
+    if (tr->have_last & (1u << p)) {
+        const Sample *last = &tr->last[p];
+        if ((tr->triggers & TRIGGER_CLICK) && (sample->mask & ~last->mask & BUTTON_MASK_ANY)) fired = 1;
+        if ((tr->triggers & TRIGGER_JUMP) && !correction) {
+            double dx = sample->x - last->x, dy = sample->y - last->y;
+            if (dx * dx + dy * dy > tr->jump_px * tr->jump_px) fired = 1;
+        }
+    }
+    tr->last[p] = *sample;
+    tr->have_last |= 1u << p;
+    return fired;
+}
+
+// Fire a trigger at 'at_ns' (sample time): start recording through with the
+// pre-roll from pre_roll_ns before it, or extend the post-roll. Returns 0
+// on success, -1 if the trace could not be written.
+int trigger_fire(TriggerRecorder *tr, TraceWriter *tw, uint64_t at_ns) {
+    atomic_fetch_add_explicit(&stats.triggers, 1, memory_order_relaxed);
+    if (!tr->recording) {
+        // New stretch: the pre-roll, oldest first
+        atomic_fetch_add_explicit(&stats.bursts, 1, memory_order_relaxed);
+        uint64_t from_ns = at_ns > tr->pre_roll_ns ? at_ns - tr->pre_roll_ns : 0;
+        for (uint64_t i = tr->tail; i != tr->head; ++i) {
+            const Sample *s = &tr->ring[i & tr->mask];
+            if (s->time_ns >= from_ns && trace_append(tw, s) != 0) return -1;
+        }
+        tr->tail = tr->head;
+        tr->recording = 1;
+        tr->until_ns = 0;
+    }
+    if (at_ns + tr->post_roll_ns > tr->until_ns) tr->until_ns = at_ns + tr->post_roll_ns;
+    return 0;
+}
+
+// Take one sample: into the trace while recording through, else into the
+// pre-roll ring, which a trigger writes out first. Costs a store unless
+// something is being recorded. 'correction': see trigger_check. Returns 0
+// on success, -1 if the trace could not be written.
+int trigger_record(TriggerRecorder *tr, TraceWriter *tw, const Sample *sample, int correction) {
+    if (trigger_check(tr, sample, correction) && trigger_fire(tr, tw, sample->time_ns) != 0) return -1;
+
+    if (tr->recording) {
+        if (sample->time_ns <= tr->until_ns) return trace_append(tw, sample);
+        tr->recording = 0; // Post-roll over; this one starts the next pre-roll
+    }
+    tr->ring[tr->head++ & tr->mask] = *sample;
+    if (tr->head - tr->tail > tr->mask + 1) tr->tail = tr->head - (tr->mask + 1); // Oldest overwritten
+    return 0;
+}
+
+// Map a recorded trace for reading. Chunks past the end of a file cut short
+// (the recorder was killed) are ignored. Returns 0 on success, -1 on error.
+int trace_reader_open(TraceReader *tr, const char *path) {
+    struct stat st;
+    memset(tr, 0, sizeof(*tr));
+    tr->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (tr->fd < 0 || fstat(tr->fd, &st) != 0) {
+        fprintf(stderr, "Error: Could not open trace file %s: %s\n", path, strerror(errno));
+        if (tr->fd >= 0) close(tr->fd);
+        return -1;
+    }
+    tr->size = (size_t)st.st_size;
+    if (tr->size < TRACE_HEADER_SIZE) {
+        fprintf(stderr, "Error: %s is not a trace file\n", path);
+        close(tr->fd); return -1;
+    }
+    void *map = mmap(NULL, tr->size, PROT_READ, MAP_PRIVATE, tr->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap(trace)");
+        close(tr->fd); return -1;
+    }
+    tr->map = map;
+    tr->header = map;
+
+    const TraceHeader *h = tr->header;
+    uint32_t encoding = h->version >= TRACE_VERSION_ENCODING ? h->encoding : TRACE_ENCODING_RAW;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version < TRACE_VERSION || h->version > TRACE_VERSION_ENCODING || encoding > TRACE_ENCODING_PACKED ||
+        h->record_size != sizeof(TraceRecord) || h->chunk_size < sizeof(TraceIndexBlock) ||
+        h->header_size < sizeof(TraceHeader) || h->header_size > tr->size) {
+        fprintf(stderr, "Error: %s is not a trace file (or an unsupported version)\n", path);
+        munmap(map, tr->size); close(tr->fd); return -1;
+    }
+    if (encoding == TRACE_ENCODING_PACKED && (h->records_per_chunk == 0 || h->records_per_chunk > TRACE_PACKED_RECORDS)) {
+        fprintf(stderr, "Error: %s has packed chunks of %u records, more than %d\n",
+                path, h->records_per_chunk, TRACE_PACKED_RECORDS);
+        munmap(map, tr->size); close(tr->fd); return -1;
+    }
+    if (encoding == TRACE_ENCODING_PACKED) {
+        svb_init();
+        tr->unpacked = malloc(TRACE_PACKED_RECORDS * sizeof(TraceRecord));
+        tr->columns = malloc(3 * TRACE_PACKED_RECORDS * sizeof(uint32_t));
+        if (!tr->unpacked || !tr->columns) {
+            fprintf(stderr, "Error: Could not allocate the trace decoder\n");
+            free(tr->unpacked); free(tr->columns);
+            munmap(map, tr->size); close(tr->fd); return -1;
+        }
+    }
+    uint64_t present = (tr->size - h->header_size + h->chunk_size - 1) / h->chunk_size;
+    tr->chunks = h->chunk_count < present ? h->chunk_count : present;
+
+    // Played strictly front to back: read ahead aggressively, drop behind
+    madvise(map, tr->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+// Index block and records of chunk k. Returns the number of records that
+// are actually in the file (0 for a damaged chunk). Packed chunks are
+// decoded into tr->unpacked, valid until the next call.
+unsigned int trace_reader_chunk(TraceReader *tr, uint64_t k, const TraceRecord **records) {
+    const TraceHeader *h = tr->header;
+    size_t offset = h->header_size + (size_t)k * h->chunk_size;
+    if (k >= tr->chunks || offset + sizeof(TraceIndexBlock) > tr->size) return 0;
+
+    const TraceIndexBlock *index = (const TraceIndexBlock *)(tr->map + offset);
+    if (index->magic != TRACE_INDEX_MAGIC) return 0;
+    if (tr->unpacked) {
+        if (index->count > h->records_per_chunk) return 0; // More than the header allows: damaged
+        size_t available = tr->size - offset - sizeof(TraceIndexBlock);
+        if (available > h->chunk_size - sizeof(TraceIndexBlock)) available = h->chunk_size - sizeof(TraceIndexBlock);
+        *records = tr->unpacked;
+        return trace_unpack_chunk(index, available, tr->unpacked, tr->columns);
+    }
+    size_t available = (tr->size - offset - sizeof(TraceIndexBlock)) / sizeof(TraceRecord);
+    *records = (const TraceRecord *)(index + 1);
+    return index->count < available ? index->count : (unsigned int)available;
+}
+
+// Ask the kernel to start reading chunks [first, first + count)
+void trace_reader_prefetch(const TraceReader *tr, uint64_t first, uint64_t count) {
+    const TraceHeader *h = tr->header;
+    if (first >= tr->chunks) return;
+    if (first + count > tr->chunks) count = tr->chunks - first;
+    size_t offset = h->header_size + (size_t)first * h->chunk_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    size_t end = offset + (size_t)count * h->chunk_size;
+    if (end > tr->size) end = tr->size;
+    madvise((void *)(tr->map + start), end - start, MADV_WILLNEED);
+}
+
+void trace_reader_close(TraceReader *tr) {
+    free(tr->unpacked);
+    free(tr->columns);
+    if (tr->map) munmap((void *)tr->map, tr->size);
+    if (tr->fd >= 0) close(tr->fd);
+    memset(tr, 0, sizeof(*tr));
+    tr->fd = -1;
+}
+
+// --- Shared-Memory Publisher ---
+
+// Create (or replace) the shared-memory ring. Returns 0 on success, -1 on error.
+int shm_open_publisher(ShmPublisher *pub, const char *name, int width, int height) {
+    memset(pub, 0, sizeof(*pub));
+    // A fresh object each time: readers still mapping an old one keep it
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create shared memory %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    pub->size = 4096 + (size_t)SHM_RING_SIZE * sizeof(ShmSlot);
+    if (ftruncate(fd, pub->size) != 0) {
+        perror("ftruncate(shm)");
+        close(fd); shm_unlink(name); return -1;
+    }
+    pub->map = mmap(NULL, pub->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the object alive
+    if (pub->map == MAP_FAILED) {
+        perror("mmap(shm)");
+        shm_unlink(name); return -1;
+    }
+    pub->name = name;
+    pub->header = pub->map;
+    pub->slots = (ShmSlot *)((unsigned char *)pub->map + 4096);
+
+    // Fresh pages are zero, so every slot starts with seq 0 (never valid)
+    pub->header->version = SHM_VERSION;
+    pub->header->header_size = 4096;
+    pub->header->slot_size = sizeof(ShmSlot);
+    pub->header->capacity = SHM_RING_SIZE;
+    pub->header->pid = getpid();
+    pub->header->screen_width = width;
+    pub->header->screen_height = height;
+    atomic_init(&pub->header->head, 0);
+    // Magic last: readers that see it see a complete header
+    atomic_thread_fence(memory_order_release);
+    memcpy(pub->header->magic, SHM_MAGIC, sizeof(pub->header->magic));
+    return 0;
+}
+
+// Publish one sample. Never blocks and never waits for readers.
+void shm_publish(ShmPublisher *pub, const Sample *sample) {
+    uint64_t i = pub->head;
+    ShmSlot *slot = &pub->slots[i & (SHM_RING_SIZE - 1)];
+
+    atomic_store_explicit(&slot->seq, 2 * i + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // Odd seq is visible before the data changes
+    slot->time_ns = sample->time_ns;
+    slot->x = sample->x;
+    slot->y = sample->y;
+    slot->mask = sample->mask | (uint32_t)sample->pointer << MASK_POINTER_SHIFT;
+    slot->child = (uint32_t)sample->child;
+    atomic_store_explicit(&slot->seq, 2 * i + 2, memory_order_release);
+
+    pub->head = i + 1;
+    atomic_store_explicit(&pub->header->head, pub->head, memory_order_release);
+}
+
+void shm_close_publisher(ShmPublisher *pub) {
+    if (pub->map && pub->map != MAP_FAILED) munmap(pub->map, pub->size);
+    if (pub->name) shm_unlink(pub->name);
+    memset(pub, 0, sizeof(*pub));
+}
+
+// --- Network Export ---
+
+// LEB128 varint at p. Returns the bytes written (at most 10).
+static inline size_t net_put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static inline uint64_t net_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+// Render thread: hand the frame being filled to the sender thread
+void net_flush(NetSink *net) {
+    if (!net->frame) return;
+    net->frame = NULL;
+    atomic_store_explicit(&net->head, atomic_load_explicit(&net->head, memory_order_relaxed) + 1,
+                          memory_order_release);
+    uint64_t one = 1;
+    if (write(net->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("write(eventfd)");
+}
+
+// Render thread: add a sample to the current frame, starting one in the
+// queue's head slot if needed. Never blocks; drops the sample if the queue
+// is full.
+void net_sample(NetSink *net, const Sample *sample) {
+    NetFrame *f = net->frame;
+    net->next++;
+    if (!f) {
+        unsigned int head = atomic_load_explicit(&net->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&net->tail, memory_order_acquire) == NET_QUEUE_FRAMES) {
+            atomic_fetch_add_explicit(&stats.net_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        f = net->frame = &net->frames[head & (NET_QUEUE_FRAMES - 1)];
+        f->first = net->next - 1;
+        f->count = 0;
+        f->size = net_put_varint(f->body, sample->time_ns);
+        net->prev = (Sample){ .time_ns = sample->time_ns };
+        net->started_ns = now_ns(CLOCK_MONOTONIC);
+    }
+
+    const Sample *prev = &net->prev;
+    unsigned int source = (unsigned int)sample->seat << 8 | sample->pointer;
+    unsigned int prev_source = (unsigned int)prev->seat << 8 | prev->pointer;
+    unsigned char *start = f->body + f->size, *p = start + 1;
+    unsigned int fields = 0;
+    p += net_put_varint(p, net_zigzag((int64_t)(sample->time_ns - prev->time_ns)));
+    if (sample->x != prev->x) {
+        fields |= NET_FIELD_X;
+        p += net_put_varint(p, net_zigzag((int64_t)sample->x - prev->x));
+    }
+    if (sample->y != prev->y) {
+        fields |= NET_FIELD_Y;
+        p += net_put_varint(p, net_zigzag((int64_t)sample->y - prev->y));
+    }
+    if (sample->mask != prev->mask) {
+        fields |= NET_FIELD_MASK;
+        p += net_put_varint(p, sample->mask ^ prev->mask);
+    }
+    if (source != prev_source) {
+        fields |= NET_FIELD_SOURCE;
+        p += net_put_varint(p, source ^ prev_source);
+    }
+    if (sample->child != prev->child) {
+        fields |= NET_FIELD_CHILD;
+        p += net_put_varint(p, (uint64_t)(sample->child ^ prev->child));
+    }
+    *start = (unsigned char)fields;
+    f->size += (size_t)(p - start);
+    f->count++;
+    net->prev = *sample;
+
+    if (f->size + NET_SAMPLE_MAX > net->body_limit) net_flush(net);
+}
+
+// When the frame being filled is due (CLOCK_MONOTONIC ns), for the render
+// thread's timer. Returns 0 if there is none.
+uint64_t net_deadline(const NetSink *net) {
+    return net->frame ? net->started_ns + NET_FLUSH_MS * 1000000ull : 0;
+}
+
+// Render thread, after each batch of samples: send the frame if it is due
+void net_batch_end(NetSink *net) {
+    if (net->frame && now_ns(CLOCK_MONOTONIC) >= net_deadline(net)) net_flush(net);
+}
+
+// Sender thread: sleep until a frame is queued, net_close is called or
+// timeout_ms (-1 = forever) passes
+void net_sleep(NetSink *net, int timeout_ms) {
+    struct pollfd pfd = { net->wake_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        uint64_t count;
+        if (read(net->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+    }
+}
+
+// Sender thread: open the socket. A TCP connect gives up after
+// NET_CONNECT_MS or when stopping. Returns 0 on success, -1 on error.
+int net_connect(NetSink *net) {
+    int fd = socket(net->addr.ss_family, (net->udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&net->addr, net->addr_len) != 0) {
+        if (errno != EINPROGRESS) goto fail;
+        uint64_t deadline = now_ns(CLOCK_MONOTONIC) + NET_CONNECT_MS * 1000000ull;
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int ready = 0;
+        while (!ready && !atomic_load(&net->stopping)) {
+            uint64_t now = now_ns(CLOCK_MONOTONIC);
+            if (now >= deadline) break;
+            // Short slices, so net_close never waits for the whole timeout
+            int slice = (int)((deadline - now) / 1000000) + 1;
+            ready = poll(&pfd, 1, slice < 100 ? slice : 100) > 0;
+        }
+        int err = ETIMEDOUT;
+        socklen_t len = sizeof(err);
+        if (ready && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) err = errno;
+        if (err) { errno = err; goto fail; }
+    }
+
+    // Blocking from here on, but a stalled peer costs a reconnect rather
+    // than a sender stuck forever in send()
+    struct timeval timeout = { NET_CONNECT_MS / 1000, (NET_CONNECT_MS % 1000) * 1000 };
+    int one = 1;
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        (!net->udp && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0)) {
+        goto fail;
+    }
+    net->fd = fd;
+    return 0;
+
+fail: {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+}
+
+// Sender thread: frame header plus the body, compressed if that makes it
+// smaller. Returns the bytes in net->out.
+size_t net_encode(NetSink *net, const NetFrame *f) {
+    unsigned char *p = net->out + 4;
+    *p++ = NET_VERSION;
+    unsigned char *codec = p++;
+    p += net_put_varint(p, f->first);
+    p += net_put_varint(p, f->count);
+    p += net_put_varint(p, f->size);
+
+    size_t packed = 0;
+    switch (net->codec) {
+#ifdef HAVE_LZ4
+    case NET_CODEC_LZ4: {
+        int n = LZ4_compress_default((const char *)f->body, (char *)p, (int)f->size, (int)f->size - 1);
+        packed = n > 0 ? (size_t)n : 0;
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case NET_CODEC_ZSTD: {
+        size_t n = ZSTD_compressCCtx(net->zstd, p, f->size - 1, f->body, f->size, NET_ZSTD_LEVEL);
+        packed = ZSTD_isError(n) ? 0 : n;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    if (packed) {
+        *codec = (unsigned char)net->codec;
+    } else {
+        *codec = NET_CODEC_NONE;
+        memcpy(p, f->body, f->size);
+        packed = f->size;
+    }
+    p += packed;
+    uint32_t length = (uint32_t)(p - net->out - 4);
+    memcpy(net->out, &length, sizeof(length));
+    return (size_t)(p - net->out);
+}
+
+// Sender thread: one whole frame (UDP: one datagram). Returns 0 on
+// success, -1 on error.
+int net_send(NetSink *net, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(net->fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+void *net_thread(void *arg) {
+    NetSink *net = arg;
+    int retry_ms = NET_RETRY_MS;
+    uint64_t retry_ns = 0; // No connect attempts before this (CLOCK_MONOTONIC)
+
+    for (;;) {
+        unsigned int tail = atomic_load_explicit(&net->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&net->head, memory_order_acquire)) {
+            if (atomic_load(&net->stopping)) break;
+            net_sleep(net, -1);
+            continue;
+        }
+        NetFrame *f = &net->frames[tail & (NET_QUEUE_FRAMES - 1)];
+
+        if (net->fd < 0) {
+            // Frames queue up meanwhile; once all slots are taken the render
+            // thread drops new samples instead
+            uint64_t now = now_ns(CLOCK_MONOTONIC);
+            if (atomic_load(&net->stopping)) {
+                atomic_fetch_add_explicit(&stats.net_dropped, f->count, memory_order_relaxed);
+                atomic_store_explicit(&net->tail, tail + 1, memory_order_release);
+                continue; // Nobody to deliver the rest to
+            }
+            if (now < retry_ns) {
+                net_sleep(net, (int)((retry_ns - now) / 1000000) + 1);
+                continue;
+            }
+            if (net_connect(net) != 0) {
+                if (!net->warned) {
+                    fprintf(stderr, "Warning: Could not connect to %s: %s (retrying)\n", net->url, strerror(errno));
+                    net->warned = 1;
+                }
+                retry_ns = now_ns(CLOCK_MONOTONIC) + (uint64_t)retry_ms * 1000000ull;
+                retry_ms = retry_ms * 2 < NET_RETRY_MAX_MS ? retry_ms * 2 : NET_RETRY_MAX_MS;
+                continue;
+            }
+            if (net->warned) fprintf(stderr, "Connected to %s\n", net->url);
+            net->warned = 0;
+            retry_ms = NET_RETRY_MS;
+        }
+
+        size_t size = net_encode(net, f);
+        if (net_send(net, net->out, size) == 0) {
+            atomic_fetch_add_explicit(&stats.net_frames, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stats.net_bytes, size, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&stats.net_dropped, f->count, memory_order_relaxed);
+            // UDP: nobody listening yet (ECONNREFUSED) is not worth a new socket.
+            // TCP: part of the frame may be out, so the stream must start over.
+            if (!net->udp) {
+                fprintf(stderr, "Warning: Lost connection to %s: %s\n", net->url,
+                        errno == EAGAIN ? "send timed out" : strerror(errno));
+                net->warned = 1;
+                close(net->fd);
+                net->fd = -1;
+            }
+        }
+        atomic_store_explicit(&net->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+// Parse "tcp://HOST:PORT" or "udp://HOST:PORT" (HOST may be a bracketed
+// IPv6 address), resolve it and start the sender thread. The first
+// connection is made in the background. Returns 0 on success, -1 on error.
+int net_open(NetSink *net, const char *url, int codec) {
+    memset(net, 0, sizeof(*net));
+    net->fd = -1;
+    net->wake_fd = -1;
+    net->url = url;
+    net->codec = codec;
+    if (strncmp(url, "tcp://", 6) == 0) net->udp = 0;
+    else if (strncmp(url, "udp://", 6) == 0) net->udp = 1;
+    else {
+        fprintf(stderr, "Error: --send takes tcp://HOST:PORT or udp://HOST:PORT, not '%s'\n", url);
+        return -1;
+    }
+    net->body_limit = net->udp ? NET_BODY_UDP : NET_BODY_TCP;
+
+    char host[256];
+    const char *name = url + 6, *colon = strrchr(name, ':');
+    size_t len = colon ? (size_t)(colon - name) : 0;
+    if (len >= 2 && name[0] == '[' && name[len - 1] == ']') {
+        name++;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(host) || !colon[1]) {
+        fprintf(stderr, "Error: --send needs a host and port, not '%s'\n", url);
+        return -1;
+    }
+    memcpy(host, name, len);
+    host[len] = '\0';
+    struct addrinfo hints = { .ai_socktype = net->udp ? SOCK_DGRAM : SOCK_STREAM }, *ai;
+    int err = getaddrinfo(host, colon + 1, &hints, &ai);
+    if (err != 0) {
+        fprintf(stderr, "Error: Could not resolve %s: %s\n", url, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&net->addr, ai->ai_addr, ai->ai_addrlen);
+    net->addr_len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    net->frames = calloc(NET_QUEUE_FRAMES, sizeof(NetFrame));
+    net->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#ifdef HAVE_ZSTD
+    if (codec == NET_CODEC_ZSTD) net->zstd = ZSTD_createCCtx();
+    if (codec == NET_CODEC_ZSTD && !net->zstd) net->codec = NET_CODEC_NONE;
+#endif
+    if (!net->frames || net->wake_fd < 0 || pthread_create(&net->tid, NULL, net_thread, net) != 0) {
+        fprintf(stderr, "Error: Could not start the network sender\n");
+        free(net->frames);
+        if (net->wake_fd >= 0) close(net->wake_fd);
+#ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(net->zstd);
+#endif
+        return -1;
+    }
+    net->started = 1;
+    return 0;
+}
+
+// Send what is still queued (if connected) and stop the sender thread
+void net_close(NetSink *net) {
+    if (!net->started) return;
+    net_flush(net);
+    atomic_store(&net->stopping, 1);
+    uint64_t one = 1;
+    if (write(net->wake_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    pthread_join(net->tid, NULL);
+    if (net->fd >= 0) close(net->fd);
+    close(net->wake_fd);
+    free(net->frames);
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(net->zstd);
+#endif
+    net->started = 0;
+}
+
+// --- XInput2 capture ---
+
+// Note valuator 'number' of a device if it is its X or Y axis. Valuators 0
+// and 1 are X and Y by convention.
+void xi2_device_axis(XI2Device *dev, int number, int absolute, double min, double max) {
+    if (number == 0) {
+        dev->x_axis = 0; dev->x_abs = absolute;
+        dev->x_min = min; dev->x_max = max;
+    } else if (number == 1) {
+        dev->y_axis = 1; dev->y_abs = absolute;
+        dev->y_min = min; dev->y_max = max;
+    }
+}
+
+// (Re)read the valuator layout of every slave pointer
+void xi2_load_devices(Display *display, XI2State *xi) {
+    int ndevices;
+    XIDeviceInfo *info = XIQueryDevice(display, XIAllDevices, &ndevices);
+
+    xi->num_devices = 0;
+    for (int i = 0; info && i < ndevices && xi->num_devices < XI2_MAX_DEVICES; ++i) {
+        XI2Device *dev = &xi->devices[xi->num_devices];
+        memset(dev, 0, sizeof(*dev));
+        dev->deviceid = info[i].deviceid;
+        dev->x_axis = dev->y_axis = -1;
+
+        for (int c = 0; c < info[i].num_classes; ++c) {
+            if (info[i].classes[c]->type != XIValuatorClass) continue;
+            XIValuatorClassInfo *v = (XIValuatorClassInfo *)info[i].classes[c];
+            xi2_device_axis(dev, v->number, v->mode == XIModeAbsolute, v->min, v->max);
+        }
+        if (dev->x_axis >= 0 || dev->y_axis >= 0) xi->num_devices++;
+    }
+    if (info) XIFreeDeviceInfo(info);
+}
+
+// Master pointer 'deviceid' (named name_len bytes of 'name') still exists:
+// mark its slot in present[]. A master keeps its slot (so its
+// Sample.pointer) for as long as it exists; new ones take the lowest free
+// slot and start with a resync.
+void xi2_track_master(XI2State *xi, int deviceid, const char *name, int name_len, int present[POINTER_MAX]) {
+    int slot = -1, free_slot = -1;
+    for (int p = 0; p < POINTER_MAX && slot < 0; ++p) {
+        if (xi->pointers[p].active && xi->pointers[p].master == deviceid) slot = p;
+        else if (!xi->pointers[p].active && free_slot < 0) free_slot = p;
+    }
+    if (slot < 0 && free_slot < 0) {
+        fprintf(stderr, "Warning: More than %d master pointers; ignoring \"%.*s\".\n",
+                POINTER_MAX, name_len, name);
+        return;
+    }
+    if (slot < 0) {
+        slot = free_slot;
+        memset(&xi->pointers[slot], 0, sizeof(xi->pointers[slot]));
+        xi->pointers[slot].master = deviceid;
+        xi->pointers[slot].active = 1;
+        xi->pointers[slot].last_x = xi->pointers[slot].last_y = -1;
+        xi->pointers[slot].resync_pending = 1;
+    }
+    present[slot] = 1;
+}
+
+// Stop following the masters xi2_track_master did not see
+void xi2_drop_masters(XI2State *xi, const int present[POINTER_MAX]) {
+    for (int p = 0; p < POINTER_MAX; ++p) {
+        if (!present[p]) xi->pointers[p].active = 0; // Master removed
+    }
+}
+
+// (Re)read the list of master pointers for --all-pointers
+void xi2_load_masters(Display *display, XI2State *xi) {
+    int ndevices;
+    XIDeviceInfo *info = XIQueryDevice(display, XIAllMasterDevices, &ndevices);
+    int present[POINTER_MAX] = { 0 };
+
+    for (int i = 0; info && i < ndevices; ++i) {
+        if (info[i].use == XIMasterPointer) {
+            xi2_track_master(xi, info[i].deviceid, info[i].name, (int)strlen(info[i].name), present);
+        }
+    }
+    xi2_drop_masters(xi, present);
+    if (info) XIFreeDeviceInfo(info);
+}
+
+// Query the extension and select events on the root window: raw input for
+// XI2 capture (plus motion, to notice warps), and hierarchy changes
+// (devices and master pointers coming and going). all_pointers follows every master pointer instead of the core one.
+// Returns 0 on success, -1 if XI2.2 is not available.
+int xi2_init(Display *display, Window root_window, XI2State *xi, int raw, int all_pointers) {
+    int event_base;
+    memset(xi, 0, sizeof(*xi));
+    xi->pointers[0].last_x = xi->pointers[0].last_y = -1;
+
+    if (!XQueryExtension(display, "XInputExtension", &xi->opcode, &event_base, &xi->error_base)) {
+        fprintf(stderr, "Warning: XInputExtension not available.\n");
+        return -1;
+    }
+    // 2.2 delivers raw events to the root window regardless of grabs
+    int major = 2, minor = 2;
+    if (XIQueryVersion(display, &major, &minor) != Success) {
+        fprintf(stderr, "Warning: XInput 2.2 not supported (server has %d.%d).\n", major, minor);
+        return -1;
+    }
+
+    unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)];
+    memset(mask_bits, 0, sizeof(mask_bits));
+    if (raw) {
+        XISetMask(mask_bits, XI_RawMotion);
+        XISetMask(mask_bits, XI_RawButtonPress);
+        XISetMask(mask_bits, XI_RawButtonRelease);
+        XISetMask(mask_bits, XI_Motion);
+    }
+    XISetMask(mask_bits, XI_HierarchyChanged);
+
+    XIEventMask evmask;
+    evmask.deviceid = XIAllMasterDevices;
+    evmask.mask_len = sizeof(mask_bits);
+    evmask.mask = mask_bits;
+    XISelectEvents(display, root_window, &evmask, 1);
+
+    if (raw) xi2_load_devices(display, xi);
+    xi->all_pointers = all_pointers;
+    if (all_pointers) xi2_load_masters(display, xi);
+    return 0;
+}
+
+XI2Device *xi2_find_device(XI2State *xi, int deviceid) {
+    for (int i = 0; i < xi->num_devices; ++i) {
+        if (xi->devices[i].deviceid == deviceid) return &xi->devices[i];
+    }
+    return NULL;
+}
+
+// Is slot 'index' followed? Without --all-pointers only the core pointer is.
+int xi2_pointer_active(const XI2State *xi, int index) {
+    return xi->all_pointers ? xi->pointers[index].active : index == 0;
+}
+
+// The tracked pointer a raw event moves: its master's, or the core
+// pointer's (every master folded into one) without --all-pointers
+XI2Pointer *xi2_find_pointer(XI2State *xi, int master) {
+    if (!xi->all_pointers) return &xi->pointers[0];
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        if (xi->pointers[i].active && xi->pointers[i].master == master) return &xi->pointers[i];
+    }
+    return NULL;
+}
+
+// Map one raw axis value onto a screen axis of the given size
+double xi2_axis_to_screen(double value, int absolute, double min, double max,
+                          double current, int size) {
+    if (!absolute) return current + value;                 // Relative: value is a delta
+    if (max > min) return (value - min) / (max - min) * (size - 1); // Device range
+    return value;                                          // Already screen coordinates
+}
+
+// Apply one raw event to the tracked state.
+// Returns the pointer to store a new sample for, NULL if there is none.
+XI2Pointer *xi2_handle_event(XI2State *xi, XIRawEvent *raw, int width, int height) {
+    XI2Pointer *p = xi2_find_pointer(xi, raw->deviceid);
+    if (!p) return NULL;
+
+    switch (raw->evtype) {
+    case XI_RawMotion: {
+        XI2Device *dev = xi2_find_device(xi, raw->sourceid);
+        if (!dev) return NULL;
+
+        // values[] only holds the valuators whose bit is set in mask
+        double *value = raw->valuators.values;
+        int moved = 0;
+        for (int i = 0; i < raw->valuators.mask_len * 8; ++i) {
+            if (!XIMaskIsSet(raw->valuators.mask, i)) continue;
+            if (i == dev->x_axis) {
+                p->x = xi2_axis_to_screen(*value, dev->x_abs, dev->x_min, dev->x_max, p->x, width);
+                moved = 1;
+            } else if (i == dev->y_axis) {
+                p->y = xi2_axis_to_screen(*value, dev->y_abs, dev->y_min, dev->y_max, p->y, height);
+                moved = 1;
+            }
+            value++;
+        }
+        if (!moved) return NULL;
+
+        // Pointer cannot leave the screen; clamp what the deltas can't know
+        if (p->x < 0) p->x = 0;
+        if (p->y < 0) p->y = 0;
+        if (p->x > width - 1) p->x = width - 1;
+        if (p->y > height - 1) p->y = height - 1;
+        p->resync_pending = 1;
+        return p;
+    }
+    case XI_RawButtonPress:
+    case XI_RawButtonRelease:
+        // Only buttons 1-5 have core mask bits
+        if (raw->detail < 1 || raw->detail > 5) return NULL;
+        if (raw->evtype == XI_RawButtonPress) {
+            p->mask |= (Button1Mask << (raw->detail - 1));
+        } else {
+            p->mask &= ~(Button1Mask << (raw->detail - 1));
+        }
+        return p;
+    }
+    return NULL;
+}
+
+// XI_Motion on the root window carries the server's own position. A warp
+// (XWarpPointer, xdotool mousemove) moves the pointer with no raw event at
+// all; where the position disagrees with the estimate, queue a resync.
+void xi2_handle_motion(XI2State *xi, int master, double root_x, double root_y) {
+    XI2Pointer *p = xi2_find_pointer(xi, master);
+    if (p && ((int)root_x != (int)p->x || (int)root_y != (int)p->y)) p->resync_pending = 1;
+}
+
+// Read one pointer's position and buttons from the server (one round trip):
+// the core pointer with XQueryPointer, a master pointer with XIQueryPointer,
+// whose button and modifier state is folded into a core mask.
+Bool xi2_query_pointer(Display *display, Window root_window, int master,
+                       int *x, int *y, unsigned int *mask, Window *child) {
+    Window root_return;
+    if (!master) {
+        int win_x, win_y;
+        return XQueryPointer(display, root_window, &root_return, child, x, y, &win_x, &win_y, mask);
+    }
+
+    double root_x, root_y, win_x, win_y;
+    XIButtonState buttons;
+    XIModifierState mods;
+    XIGroupState group;
+    if (!XIQueryPointer(display, master, root_window, &root_return, child,
+                        &root_x, &root_y, &win_x, &win_y, &buttons, &mods, &group)) return False;
+    *x = (int)root_x;
+    *y = (int)root_y;
+    *mask = (unsigned int)mods.effective;
+    for (int b = 1; b <= 5 && b < buttons.mask_len * 8; ++b) {
+        if (XIMaskIsSet(buttons.mask, b)) *mask |= Button1Mask << (b - 1);
+    }
+    free(buttons.mask);
+    return True;
+}
+
+// Reset one tracked pointer's position and buttons from the server
+int xi2_resync(Display *display, Window root_window, XI2Pointer *p) {
+    Window child_return;
+    int root_x, root_y;
+    unsigned int mask;
+
+    p->resync_pending = 0;
+    uint64_t sent_ns = now_ns(CLOCK_MONOTONIC);
+    Bool result = xi2_query_pointer(display, root_window, p->master, &root_x, &root_y, &mask, &child_return);
+    hist_record(&stats.query_rtt, now_ns(CLOCK_MONOTONIC) - sent_ns);
+    if (!result) return 0;
+    int changed = ((int)p->x != root_x || (int)p->y != root_y || p->mask != mask);
+    p->x = root_x;
+    p->y = root_y;
+    p->mask = mask;
+    p->child = child_return;
+    return changed;
+}
+
+// Hand a finished sample to every consumer: the trace file and shared
+// memory (written here, so a slow render thread can never cost them
+// samples) and the ring
+void capture_emit(CaptureContext *ctx, const Sample *sample) {
+    if (ctx->trace &&
+        (ctx->trigger ? trigger_record(ctx->trigger, ctx->trace, sample, ctx->resyncing)
+                      : trace_append(ctx->trace, sample)) != 0) {
+        fprintf(stderr, "Warning: Trace recording stopped.\n");
+        ctx->trace = NULL;
+    }
+    if (ctx->shm) shm_publish(ctx->shm, sample);
+    if (ctx->mode == CAPTURE_REPLAY) {
+        ring_push_wait(ctx->ring, sample); // A replay can wait, but must not drop
+    } else {
+        ring_push(ctx->ring, sample);
+    }
+}
+
+// --trigger signal: fire a pending SIGUSR2 trigger at the time it came in
+// (live sample times are CLOCK_MONOTONIC too). A replay, whose samples
+// carry the trace's times, checks before each record and passes its time
+// as 'replay_ns'.
+void capture_trigger_signal(CaptureContext *ctx, uint64_t replay_ns) {
+    if (!ctx->trigger) return;
+    uint64_t at_ns = trigger_take_signal(ctx->trigger); // Drained even with no trace left
+    if (!at_ns || !ctx->trace) return;
+    if (trigger_fire(ctx->trigger, ctx->trace, ctx->mode == CAPTURE_REPLAY ? replay_ns : at_ns) != 0) {
+        fprintf(stderr, "Warning: Trace recording stopped.\n");
+        ctx->trace = NULL;
+    }
+}
+
+// The trigger's wakeup eventfd, -1 if there is none to watch
+int capture_trigger_fd(const CaptureContext *ctx) {
+    return ctx->trigger && ctx->trace ? ctx->trigger->wake_fd : -1;
+}
+
+// Sleep until 'deadline' or until stop_fd is signalled, firing --trigger
+// signal on the way. Returns -1 once the loop has to end, 0 otherwise.
+int capture_sleep_until(CaptureContext *ctx, uint64_t deadline) {
+    for (uint64_t now; (now = now_ns(CLOCK_MONOTONIC)) < deadline && keep_running;) {
+        struct pollfd fds[2] = {
+            { .fd = ctx->stop_fd, .events = POLLIN },
+            { .fd = capture_trigger_fd(ctx), .events = POLLIN }, // poll skips it when -1
+        };
+        struct timespec timeout = { (time_t)((deadline - now) / 1000000000ull), (long)((deadline - now) % 1000000000ull) };
+        if (ppoll(fds, 2, &timeout, NULL) < 0 && errno != EINTR) {
+            perror("ppoll");
+            return -1;
+        }
+        if (fds[0].revents & POLLIN) return -1;
+        if (fds[1].revents & POLLIN) capture_trigger_signal(ctx, 0);
+    }
+    return 0;
+}
+
+// Queue a pointer's current XI2 estimate
+void xi2_publish(CaptureContext *ctx, const XI2Pointer *p) {
+    Sample sample = { .time_ns = now_ns(CLOCK_MONOTONIC), .x = (int)p->x, .y = (int)p->y,
+                      .mask = p->mask, .seat = (uint16_t)ctx->seat,
+                      .pointer = (uint16_t)(p - ctx->xi.pointers), .child = p->child };
+    capture_emit(ctx, &sample);
+}
+
+// Resync every followed pointer and queue what changed. Resyncs all of
+// them, not only pending ones, when 'all' is set (e.g. new masters). A
+// master removed before its hierarchy event is read is dropped.
+void xi2_resync_all(CaptureContext *ctx, int all) {
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        XI2Pointer *p = &ctx->xi.pointers[i];
+        if (!xi2_pointer_active(&ctx->xi, i) || (!all && !p->resync_pending)) continue;
+        XErrorTrap trap;
+        if (p->master) x_trap_begin(&trap, ctx->display, ctx->xi.error_base + XI_BadDevice, 0);
+        int changed = xi2_resync(ctx->display, ctx->root_window, p);
+        if (p->master && x_trap_end(&trap)) {
+            p->active = 0;
+            continue;
+        }
+        ctx->resyncing = 1;
+        if (changed || all) xi2_publish(ctx, p);
+        ctx->resyncing = 0;
+    }
+}
+
+// Event-driven capture: blocks in select until the server has input for us
+void capture_xi2_loop(CaptureContext *ctx) {
+    Display *display = ctx->display;
+    XI2State *xi = &ctx->xi;
+    int xfd = ConnectionNumber(display);
+
+    // Start from the real positions so the first deltas land in the right place
+    xi2_resync_all(ctx, 1);
+
+    while (keep_running) {
+        // 1. Drain everything the server has sent
+        int hierarchy_changed = 0;
+        while (XPending(display)) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+            XGenericEventCookie *cookie = &ev.xcookie;
+            if (cookie->type != GenericEvent || cookie->extension != xi->opcode) continue;
+            if (!XGetEventData(display, cookie)) continue;
+
+            XI2Pointer *p;
+            if (cookie->evtype == XI_HierarchyChanged) {
+                hierarchy_changed = 1;
+            } else if (cookie->evtype == XI_Motion) {
+                const XIDeviceEvent *motion = cookie->data;
+                xi2_handle_motion(xi, motion->deviceid, motion->root_x, motion->root_y);
+            } else if ((p = xi2_handle_event(xi, cookie->data, ctx->width, ctx->height))) {
+                xi2_publish(ctx, p);
+            }
+            XFreeEventData(display, cookie);
+        }
+        if (hierarchy_changed) {
+            xi2_load_devices(display, xi);
+            if (xi->all_pointers) {
+                xi2_load_masters(display, xi);
+                xi2_resync_all(ctx, 1);
+            }
+        }
+
+        // 2. Sleep until input arrives; time out only to confirm an estimate
+        int resync_pending = 0;
+        for (int i = 0; i < POINTER_MAX; ++i) {
+            if (xi2_pointer_active(xi, i) && xi->pointers[i].resync_pending) resync_pending = 1;
+        }
+        // The trigger fd goes away if the trace stops
+        int trigger_fd = capture_trigger_fd(ctx);
+        int nfds = (xfd > ctx->stop_fd ? xfd : ctx->stop_fd) + 1;
+        if (trigger_fd >= nfds) nfds = trigger_fd + 1;
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(xfd, &fds);
+        FD_SET(ctx->stop_fd, &fds);
+        if (trigger_fd >= 0) FD_SET(trigger_fd, &fds);
+        struct timeval timeout = { 0, XI2_RESYNC_MS * 1000 };
+        int ready = select(nfds, &fds, NULL, NULL, resync_pending ? &timeout : NULL);
+        if (ready < 0 && errno != EINTR) {
+            perror("select");
+            break;
+        }
+        if (ready > 0 && FD_ISSET(ctx->stop_fd, &fds)) break;
+        if (ready > 0 && trigger_fd >= 0 && FD_ISSET(trigger_fd, &fds)) capture_trigger_signal(ctx, 0);
+        if (ready == 0) xi2_resync_all(ctx, 0);
+    }
+}
+
+// Polling with --all-pointers: pick up master pointers added or removed.
+// Query replies read any pending events into the queue along the way, so
+// looking at what is already queued needs no extra syscall.
+void capture_poll_hierarchy(CaptureContext *ctx) {
+    int changed = 0;
+    while (XEventsQueued(ctx->display, QueuedAlready)) {
+        XEvent ev;
+        XNextEvent(ctx->display, &ev);
+        if (ev.xcookie.type == GenericEvent && ev.xcookie.extension == ctx->xi.opcode &&
+            ev.xcookie.evtype == XI_HierarchyChanged) changed = 1;
+    }
+    if (changed) xi2_load_masters(ctx->display, &ctx->xi);
+}
+
+// Polling capture: one query round-trip per followed pointer per interval.
+// The interval snaps to fast_interval while a pointer moves or a button is
+// held, and stretches by ADAPT_BACKOFF per idle tick up to idle_interval.
+// Ticks are scheduled on absolute CLOCK_MONOTONIC deadlines, so the period
+// doesn't drift by the query time; a tick that is already past when we get
+// to it is skipped (and counted) rather than run late.
+void capture_poll_loop(CaptureContext *ctx) {
+    // Variables for the pointer query
+    Window child_return;
+    int root_x_return, root_y_return;
+    unsigned int mask_return; // This holds the button state
+
+    XI2State *xi = &ctx->xi;
+    double interval = ctx->fast_interval;
+    uint64_t deadline = now_ns(CLOCK_MONOTONIC);
+
+    while (keep_running) {
+        if (xi->all_pointers) capture_poll_hierarchy(ctx);
+
+        int active = 0;
+        const char *failed = NULL; // Call that failed this tick
+        for (int i = 0; i < POINTER_MAX; ++i) {
+            if (!xi2_pointer_active(xi, i)) continue;
+            XI2Pointer *p = &xi->pointers[i];
+
+            // 1. Get current mouse position AND button state. The server reads
+            // the pointer somewhere inside the round-trip; stamp the midpoint.
+            // A master removed since the last hierarchy check answers with
+            // BadDevice: drop it, like the XCB loop.
+            XErrorTrap trap;
+            if (p->master) x_trap_begin(&trap, ctx->display, xi->error_base + XI_BadDevice, 0);
+            uint64_t sent_ns = now_ns(CLOCK_MONOTONIC);
+            Bool result = xi2_query_pointer(ctx->display, ctx->root_window, p->master,
+                                            &root_x_return, &root_y_return,
+                                            &mask_return, &child_return); // Contains button state
+            uint64_t received_ns = now_ns(CLOCK_MONOTONIC);
+            hist_record(&stats.query_rtt, received_ns - sent_ns);
+            hist_record(&stats.jitter, sent_ns > deadline ? sent_ns - deadline : 0);
+            if (p->master && x_trap_end(&trap)) {
+                p->active = 0;
+                continue;
+            }
+            if (!result) {
+                failed = p->master ? "XIQueryPointer" : "XQueryPointer";
+                continue;
+            }
+
+            // 2. Hand the sample on
+            Sample sample = { .time_ns = sent_ns + (received_ns - sent_ns) / 2,
+                              .x = root_x_return, .y = root_y_return, .mask = mask_return,
+                              .seat = (uint16_t)ctx->seat, .pointer = (uint16_t)i, .child = child_return };
+            capture_emit(ctx, &sample);
+
+            if (root_x_return != p->last_x || root_y_return != p->last_y || (mask_return & BUTTON_MASK_ANY)) {
+                active = 1;
+            }
+            p->last_x = root_x_return;
+            p->last_y = root_y_return;
+        }
+
+        // 3. Pick the next interval
+        uint64_t step_ns;
+        if (failed) {
+            // Handle query failure
+            fprintf(stderr, "\nWarning: %s failed.\n", failed);
+            step_ns = 100000000ull; // Sleep longer
+        } else {
+            if (active) {
+                interval = ctx->fast_interval;
+            } else if (interval < ctx->idle_interval) {
+                interval *= ADAPT_BACKOFF;
+                if (interval > ctx->idle_interval) interval = ctx->idle_interval;
+            }
+            step_ns = (uint64_t)(interval * 1000);
+        }
+
+        // 4. Sleep until the next deadline, skipping any we already missed
+        deadline += step_ns;
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        if (now >= deadline) {
+            uint64_t missed = (now - deadline) / step_ns + 1;
+            atomic_fetch_add_explicit(&stats.missed_deadlines, missed, memory_order_relaxed);
+            deadline += missed * step_ns;
+        }
+        if (capture_sleep_until(ctx, deadline) != 0) break;
+    }
+}
+
+// Feed a recorded trace into the ring with its original timestamps, paced
+// at replay_speed times real time (or as fast as the render side keeps up).
+// Ends the program once the trace has been played.
+void capture_replay_loop(CaptureContext *ctx) {
+    TraceReader *tr = ctx->replay;
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    uint64_t first_time_ns = 0;
+    int started = 0;
+
+    trace_reader_prefetch(tr, 0, REPLAY_READAHEAD_CHUNKS);
+    for (uint64_t k = 0; k < tr->chunks && keep_running; ++k) {
+        // Keep the readahead window REPLAY_READAHEAD_CHUNKS ahead
+        if (k % (REPLAY_READAHEAD_CHUNKS / 2) == 0) {
+            trace_reader_prefetch(tr, k + REPLAY_READAHEAD_CHUNKS / 2, REPLAY_READAHEAD_CHUNKS);
+        }
+        const TraceRecord *records;
+        unsigned int count = trace_reader_chunk(tr, k, &records);
+
+        for (unsigned int i = 0; i < count && keep_running; ++i) {
+            const TraceRecord *rec = &records[i];
+            if (!started) {
+                first_time_ns = rec->time_ns;
+                started = 1;
+            }
+            if (ctx->replay_speed > 0 && rec->time_ns > first_time_ns) {
+                uint64_t offset = (uint64_t)((rec->time_ns - first_time_ns) / ctx->replay_speed);
+                if (start_ns + offset > now_ns(CLOCK_MONOTONIC)) sleep_until_ns(start_ns + offset);
+            }
+            capture_trigger_signal(ctx, rec->time_ns);
+            Sample sample = { .time_ns = rec->time_ns, .x = rec->x, .y = rec->y,
+                              .mask = rec->mask & ((1u << MASK_POINTER_SHIFT) - 1),
+                              .pointer = (uint16_t)(rec->mask >> MASK_POINTER_SHIFT),
+                              .child = rec->child };
+            capture_emit(ctx, &sample);
+        }
+    }
+
+    // Trace played out: stop, and wake the render thread so it notices
+    keep_running = 0;
+    uint64_t one = 1;
+    if (write(ctx->ring->wake_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+}
+
+#ifdef HAVE_XCB
+// --- XCB Capture ---
+// The same polling and XI2 capture as above, on an XCB connection. XCB
+// hands out a cookie per request instead of blocking on its reply, so the
+// polling loop keeps queries in flight across ticks: the sampling rate is
+// bounded by what the server can answer, not by the round trip.
+
+// One pointer query on its way (XCB polling)
+typedef struct {
+    unsigned int sequence; // Cookie of the query
+    int pointer;           // XI2State.pointers slot it reads
+    int master;            // Device queried, 0 for the core pointer
+    uint64_t sent_ns;
+} XcbQuery;
+
+double xcb_fp3232_to_double(xcb_input_fp3232_t v) {
+    return v.integral + v.frac / 4294967296.0;
+}
+
+// Ask for one pointer's position and buttons, without waiting for the
+// answer. Returns the request's sequence number.
+unsigned int xcb_send_query(CaptureContext *ctx, const XI2Pointer *p) {
+    if (!p->master) return xcb_query_pointer(ctx->conn, (xcb_window_t)ctx->root_window).sequence;
+    return xcb_input_xi_query_pointer(ctx->conn, (xcb_window_t)ctx->root_window,
+                                      (xcb_input_device_id_t)p->master).sequence;
+}
+
+// Read the reply to xcb_send_query, like xi2_query_pointer. Returns 0 if
+// there is none (the query failed).
+int xcb_parse_query(const void *reply, int master, int *x, int *y, unsigned int *mask, Window *child) {
+    if (!reply) return 0;
+    if (!master) {
+        const xcb_query_pointer_reply_t *r = reply;
+        *x = r->root_x;
+        *y = r->root_y;
+        *mask = r->mask;
+        *child = r->child;
+        return 1;
+    }
+    const xcb_input_xi_query_pointer_reply_t *r = reply;
+    const uint32_t *buttons = xcb_input_xi_query_pointer_buttons(r);
+    *x = r->root_x >> 16; // 16.16 fixed point
+    *y = r->root_y >> 16;
+    *mask = r->mods.effective;
+    for (int b = 1; b <= 5 && b < r->buttons_len * 32; ++b) {
+        if (buttons[b / 32] & (1u << (b % 32))) *mask |= Button1Mask << (b - 1);
+    }
+    *child = r->child;
+    return 1;
+}
+
+// Take slave valuator layouts and/or master pointers from an XIQueryDevice
+// reply for every device, which carries both
+void xcb_xi2_load(XI2State *xi, const xcb_input_xi_query_device_reply_t *reply, int devices, int masters) {
+    int present[POINTER_MAX] = { 0 };
+    if (devices) xi->num_devices = 0;
+
+    xcb_input_xi_device_info_iterator_t it = xcb_input_xi_query_device_infos_iterator(reply);
+    for (; it.rem; xcb_input_xi_device_info_next(&it)) {
+        const xcb_input_xi_device_info_t *info = it.data;
+        if (masters && info->type == XCB_INPUT_DEVICE_TYPE_MASTER_POINTER) {
+            xi2_track_master(xi, info->deviceid, xcb_input_xi_device_info_name(info),
+                             xcb_input_xi_device_info_name_length(info), present);
+        }
+        if (!devices || xi->num_devices == XI2_MAX_DEVICES) continue;
+
+        XI2Device *dev = &xi->devices[xi->num_devices];
+        memset(dev, 0, sizeof(*dev));
+        dev->deviceid = info->deviceid;
+        dev->x_axis = dev->y_axis = -1;
+        xcb_input_device_class_iterator_t c = xcb_input_xi_device_info_classes_iterator(info);
+        for (; c.rem; xcb_input_device_class_next(&c)) {
+            if (c.data->type != XCB_INPUT_DEVICE_CLASS_TYPE_VALUATOR) continue;
+            const xcb_input_valuator_class_t *v = (const xcb_input_valuator_class_t *)c.data;
+            xi2_device_axis(dev, v->number, v->mode == XCB_INPUT_VALUATOR_MODE_ABSOLUTE,
+                            xcb_fp3232_to_double(v->min), xcb_fp3232_to_double(v->max));
+        }
+        if (dev->x_axis >= 0 || dev->y_axis >= 0) xi->num_devices++;
+    }
+    if (masters) xi2_drop_masters(xi, present);
+}
+
+// Re-read the device list after a hierarchy change: one round trip
+void xcb_xi2_reload(CaptureContext *ctx, int devices, int masters) {
+    xcb_input_xi_query_device_reply_t *reply = xcb_input_xi_query_device_reply(
+        ctx->conn, xcb_input_xi_query_device(ctx->conn, XCB_INPUT_DEVICE_ALL), NULL);
+    if (!reply) return;
+    xcb_xi2_load(&ctx->xi, reply, devices, masters);
+    free(reply);
+}
+
+// Apply one raw event through xi2_handle_event. Only valuators 0-31 are
+// passed on; X and Y are 0 and 1.
+XI2Pointer *xcb_xi2_handle_event(XI2State *xi, const xcb_input_raw_button_press_event_t *ev,
+                                 int width, int height) {
+    unsigned char mask[4] = { 0 };
+    double values[32];
+    if (ev->valuators_len > 0) {
+        const uint32_t *words = xcb_input_raw_button_press_valuator_mask(ev);
+        const xcb_input_fp3232_t *axis = xcb_input_raw_button_press_axisvalues(ev);
+        int n = 0;
+        for (int i = 0; i < 32; ++i) {
+            if (!(words[0] & (1u << i))) continue;
+            XISetMask(mask, i);
+            values[n] = xcb_fp3232_to_double(axis[n]);
+            n++;
+        }
+    }
+    XIRawEvent raw;
+    memset(&raw, 0, sizeof(raw));
+    raw.evtype = ev->event_type; // XI_Raw* and XCB_INPUT_RAW_* are both the protocol numbers
+    raw.deviceid = ev->deviceid;
+    raw.sourceid = ev->sourceid;
+    raw.detail = (int)ev->detail;
+    raw.valuators.mask_len = sizeof(mask);
+    raw.valuators.mask = mask;
+    raw.valuators.values = values;
+    return xi2_handle_event(xi, &raw, width, height);
+}
+
+// Resync every followed pointer (only the pending ones unless 'all') and
+// queue what changed. All queries go out before the first reply is read,
+// so this is one round trip however many pointers there are.
+void xcb_resync_all(CaptureContext *ctx, int all) {
+    unsigned int sequence[POINTER_MAX];
+    int sent[POINTER_MAX] = { 0 };
+    uint64_t sent_ns = now_ns(CLOCK_MONOTONIC);
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        XI2Pointer *p = &ctx->xi.pointers[i];
+        if (!xi2_pointer_active(&ctx->xi, i) || (!all && !p->resync_pending)) continue;
+        p->resync_pending = 0;
+        sequence[i] = xcb_send_query(ctx, p);
+        sent[i] = 1;
+    }
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        if (!sent[i]) continue;
+        XI2Pointer *p = &ctx->xi.pointers[i];
+        xcb_generic_error_t *error = NULL;
+        void *reply = xcb_wait_for_reply(ctx->conn, sequence[i], &error);
+        hist_record(&stats.query_rtt, now_ns(CLOCK_MONOTONIC) - sent_ns);
+        int x, y;
+        unsigned int mask;
+        Window child;
+        if (xcb_parse_query(reply, p->master, &x, &y, &mask, &child)) {
+            int changed = ((int)p->x != x || (int)p->y != y || p->mask != mask);
+            p->x = x;
+            p->y = y;
+            p->mask = mask;
+            p->child = child;
+            ctx->resyncing = 1;
+            if (changed || all) xi2_publish(ctx, p);
+            ctx->resyncing = 0;
+        }
+        free(reply);
+        free(error);
+    }
+}
+
+// Read the events XCB has for us. Returns 1 if the device hierarchy changed.
+// With 'publish', raw input is applied and queued.
+int xcb_capture_events(CaptureContext *ctx, int publish) {
+    int hierarchy_changed = 0;
+    xcb_generic_event_t *ev;
+    while ((ev = xcb_poll_for_event(ctx->conn))) {
+        const xcb_ge_generic_event_t *ge = (const xcb_ge_generic_event_t *)ev;
+        if ((ev->response_type & 0x7f) == XCB_GE_GENERIC && ge->extension == ctx->xi.opcode) {
+            XI2Pointer *p;
+            if (ge->event_type == XCB_INPUT_HIERARCHY) {
+                hierarchy_changed = 1;
+            } else if (ge->event_type == XCB_INPUT_MOTION) {
+                const xcb_input_motion_event_t *motion = (const xcb_input_motion_event_t *)ev;
+                if (publish) xi2_handle_motion(&ctx->xi, motion->deviceid, motion->root_x / 65536.0,
+                                               motion->root_y / 65536.0);
+            } else if (publish &&
+                       (p = xcb_xi2_handle_event(&ctx->xi, (const xcb_input_raw_button_press_event_t *)ev,
+                                                 ctx->width, ctx->height))) {
+                xi2_publish(ctx, p);
+            }
+        }
+        free(ev);
+    }
+    return hierarchy_changed;
+}
+
+// Sleep until the connection has data, stop_fd is signalled or 'deadline'
+// (0: none) passes. Returns -1 once the loop has to end, 0 otherwise.
+int xcb_capture_wait(CaptureContext *ctx, uint64_t deadline) {
+    struct pollfd fds[3] = {
+        { .fd = xcb_get_file_descriptor(ctx->conn), .events = POLLIN },
+        { .fd = ctx->stop_fd, .events = POLLIN },
+        { .fd = capture_trigger_fd(ctx), .events = POLLIN }, // poll skips it when -1
+    };
+    struct timespec timeout, *t = NULL;
+    if (deadline) {
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        uint64_t left = deadline > now ? deadline - now : 0;
+        timeout.tv_sec = (time_t)(left / 1000000000ull);
+        timeout.tv_nsec = (long)(left % 1000000000ull);
+        t = &timeout;
+    }
+    if (ppoll(fds, 3, t, NULL) < 0 && errno != EINTR) {
+        perror("ppoll");
+        return -1;
+    }
+    if (fds[1].revents & POLLIN) return -1;
+    if (fds[2].revents & POLLIN) capture_trigger_signal(ctx, 0);
+    if (xcb_connection_has_error(ctx->conn)) {
+        fprintf(stderr, "\nError: Lost the X connection.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Pipelined polling. Each tick sends one query per followed pointer and
+// goes back to sleep; replies are read as they arrive, in order, and each
+// is stamped at the midpoint of its own round trip. Ticks, interval
+// adaptation and missed deadlines work as in capture_poll_loop.
+void capture_xcb_poll_loop(CaptureContext *ctx) {
+    XI2State *xi = &ctx->xi;
+    XcbQuery queries[XCB_QUERIES_IN_FLIGHT]; // FIFO, [head, tail) in flight
+    unsigned int head = 0, tail = 0;
+    double interval = ctx->fast_interval;
+    uint64_t deadline = now_ns(CLOCK_MONOTONIC);
+    int active = 0, failed = 0; // Seen in the replies since the last tick
+
+    while (keep_running) {
+        // 1. On each tick, send this tick's queries, unless the server is still
+        // working through earlier ones
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        if (now >= deadline) {
+            hist_record(&stats.jitter, now - deadline);
+            unsigned int count = 0;
+            for (int i = 0; i < POINTER_MAX; ++i) count += (unsigned int)xi2_pointer_active(xi, i);
+            if (tail - head + count <= XCB_QUERIES_IN_FLIGHT) {
+                for (int i = 0; i < POINTER_MAX; ++i) {
+                    if (!xi2_pointer_active(xi, i)) continue;
+                    XcbQuery *q = &queries[tail++ % XCB_QUERIES_IN_FLIGHT];
+                    q->pointer = i;
+                    q->master = xi->pointers[i].master;
+                    q->sent_ns = now_ns(CLOCK_MONOTONIC);
+                    q->sequence = xcb_send_query(ctx, &xi->pointers[i]);
+                }
+                xcb_flush(ctx->conn);
+            } else {
+                atomic_fetch_add_explicit(&stats.missed_deadlines, 1, memory_order_relaxed);
+            }
+
+            uint64_t step_ns;
+            if (failed) {
+                fprintf(stderr, "\nWarning: Pointer query failed.\n");
+                step_ns = 100000000ull; // Sleep longer
+            } else {
+                if (active) {
+                    interval = ctx->fast_interval;
+                } else if (interval < ctx->idle_interval) {
+                    interval *= ADAPT_BACKOFF;
+                    if (interval > ctx->idle_interval) interval = ctx->idle_interval;
+                }
+                step_ns = (uint64_t)(interval * 1000);
+            }
+            active = failed = 0;
+            deadline += step_ns;
+            now = now_ns(CLOCK_MONOTONIC);
+            if (now >= deadline) {
+                uint64_t missed = (now - deadline) / step_ns + 1;
+                atomic_fetch_add_explicit(&stats.missed_deadlines, missed, memory_order_relaxed);
+                deadline += missed * step_ns;
+            }
+        }
+
+        // 2. Hierarchy changes (--all-pointers), then the replies that are in.
+        // A query for a master that has gone since is answered with an error
+        // and dropped.
+        if (xcb_capture_events(ctx, 0) && xi->all_pointers) xcb_xi2_reload(ctx, 0, 1);
+        while (head != tail) {
+            XcbQuery *q = &queries[head % XCB_QUERIES_IN_FLIGHT];
+            void *reply = NULL;
+            xcb_generic_error_t *error = NULL;
+            if (!xcb_poll_for_reply(ctx->conn, q->sequence, &reply, &error)) break;
+            head++;
+            uint64_t received_ns = now_ns(CLOCK_MONOTONIC);
+            hist_record(&stats.query_rtt, received_ns - q->sent_ns);
+
+            XI2Pointer *p = &xi->pointers[q->pointer];
+            int x, y;
+            unsigned int mask;
+            Window child;
+            if (!xcb_parse_query(reply, q->master, &x, &y, &mask, &child)) {
+                if (xi2_pointer_active(xi, q->pointer) && p->master == q->master) failed = 1;
+            } else if (xi2_pointer_active(xi, q->pointer) && p->master == q->master) {
+                Sample sample = { .time_ns = q->sent_ns + (received_ns - q->sent_ns) / 2,
+                                  .x = x, .y = y, .mask = mask, .seat = (uint16_t)ctx->seat,
+                                  .pointer = (uint16_t)q->pointer, .child = child };
+                capture_emit(ctx, &sample);
+                if (x != p->last_x || y != p->last_y || (mask & BUTTON_MASK_ANY)) active = 1;
+                p->last_x = x;
+                p->last_y = y;
+            }
+            free(reply);
+            free(error);
+        }
+
+        // 3. Sleep until the next tick or the next reply
+        if (xcb_capture_wait(ctx, deadline) != 0) break;
+    }
+}
+
+// Event-driven capture, as capture_xi2_loop
+void capture_xcb_xi2_loop(CaptureContext *ctx) {
+    XI2State *xi = &ctx->xi;
+
+    // Start from the real positions so the first deltas land in the right place
+    xcb_resync_all(ctx, 1);
+
+    while (keep_running) {
+        // 1. Drain everything the server has sent. Replies read on the way
+        // can queue more events, so go round again after a reload.
+        if (xcb_capture_events(ctx, 1)) {
+            xcb_xi2_reload(ctx, 1, xi->all_pointers);
+            if (xi->all_pointers) xcb_resync_all(ctx, 1);
+            continue;
+        }
+
+        // 2. Sleep until input arrives; time out only to confirm an estimate
+        int resync_pending = 0;
+        for (int i = 0; i < POINTER_MAX; ++i) {
+            if (xi2_pointer_active(xi, i) && xi->pointers[i].resync_pending) resync_pending = 1;
+        }
+        uint64_t deadline = resync_pending ? now_ns(CLOCK_MONOTONIC) + XI2_RESYNC_MS * 1000000ull : 0;
+        if (xcb_capture_wait(ctx, deadline) != 0) break;
+        if (deadline && now_ns(CLOCK_MONOTONIC) >= deadline) xcb_resync_all(ctx, 0);
+    }
+}
+
+// Open the capture connection with XCB and set XInput2 up on it as
+// xi2_init does. After the extension lookup, the version check, event
+// selection and device list go out together: two round trips in all.
+// Returns 0 on success (falling back to polling without XI2.2 like the Xlib
+// path), -1 on error.
+int xcb_capture_init(CaptureContext *ctx, const char *name, int mode, int all_pointers) {
+    int screen;
+    ctx->conn = xcb_connect(name, &screen);
+    if (xcb_connection_has_error(ctx->conn)) {
+        fprintf(stderr, "Error: Could not open X display %s for capture\n", XDisplayName(name));
+        return -1;
+    }
+    xcb_screen_iterator_t it = xcb_setup_roots_iterator(xcb_get_setup(ctx->conn));
+    for (int i = 0; i < screen && it.rem; ++i) xcb_screen_next(&it);
+    ctx->root_window = it.data->root;
+
+    XI2State *xi = &ctx->xi;
+    memset(xi, 0, sizeof(*xi));
+    xi->pointers[0].last_x = xi->pointers[0].last_y = -1;
+    ctx->mode = mode;
+    if (mode != CAPTURE_XI2 && !all_pointers) return 0; // Core polling needs no extension
+
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(ctx->conn, &xcb_input_id);
+    if (!ext || !ext->present) {
+        fprintf(stderr, "Warning: XInputExtension not available.\n");
+    } else {
+        xi->opcode = ext->major_opcode;
+        xcb_input_xi_query_version_cookie_t version = xcb_input_xi_query_version(ctx->conn, 2, 2);
+        struct {
+            xcb_input_event_mask_t head;
+            uint32_t mask;
+        } evmask = { { XCB_INPUT_DEVICE_ALL_MASTER, 1 }, XCB_INPUT_XI_EVENT_MASK_HIERARCHY };
+        if (mode == CAPTURE_XI2) {
+            evmask.mask |= XCB_INPUT_XI_EVENT_MASK_RAW_MOTION | XCB_INPUT_XI_EVENT_MASK_RAW_BUTTON_PRESS |
+                           XCB_INPUT_XI_EVENT_MASK_RAW_BUTTON_RELEASE | XCB_INPUT_XI_EVENT_MASK_MOTION;
+        }
+        xcb_input_xi_select_events(ctx->conn, (xcb_window_t)ctx->root_window, 1, &evmask.head);
+        xcb_input_xi_query_device_cookie_t devices = xcb_input_xi_query_device(ctx->conn, XCB_INPUT_DEVICE_ALL);
+
+        xcb_input_xi_query_version_reply_t *v = xcb_input_xi_query_version_reply(ctx->conn, version, NULL);
+        xcb_input_xi_query_device_reply_t *d = xcb_input_xi_query_device_reply(ctx->conn, devices, NULL);
+        int ok = v && (v->major_version > 2 || (v->major_version == 2 && v->minor_version >= 2));
+        if (!ok) {
+            fprintf(stderr, "Warning: XInput 2.2 not supported (server has %d.%d).\n",
+                    v ? v->major_version : 0, v ? v->minor_version : 0);
+        } else if (d) {
+            xi->all_pointers = all_pointers;
+            xcb_xi2_load(xi, d, mode == CAPTURE_XI2, all_pointers);
+        }
+        free(v);
+        free(d);
+        if (ok) return 0;
+    }
+    if (mode == CAPTURE_XI2) fprintf(stderr, "Warning: Falling back to XQueryPointer polling.\n");
+    else fprintf(stderr, "Warning: Following the core pointer only.\n");
+    ctx->mode = CAPTURE_POLL;
+    return 0;
+}
+#endif
+
+void *capture_thread(void *arg) {
+    CaptureContext *ctx = arg;
+    if (ctx->mode == CAPTURE_REPLAY) {
+        capture_replay_loop(ctx);
+#ifdef HAVE_XCB
+    } else if (ctx->use_xcb) {
+        if (ctx->mode == CAPTURE_XI2) capture_xcb_xi2_loop(ctx);
+        else capture_xcb_poll_loop(ctx);
+#endif
+    } else if (ctx->mode == CAPTURE_XI2) {
+        capture_xi2_loop(ctx);
+    } else {
+        capture_poll_loop(ctx);
+    }
+    return NULL;
+}
+
+// --- Cairo Renderer ---
+
+void cairo_backend_destroy(Overlay *overlay) {
+    CairoRenderer *r = &overlay->cairo;
+    sprites_destroy(&r->sprites);
+    if (r->cr) cairo_destroy(r->cr);
+    if (r->surface) cairo_surface_destroy(r->surface);
+    if (r->back) XFreePixmap(overlay->display, r->back);
+    memset(r, 0, sizeof(*r));
+}
+
+int cairo_backend_init(Overlay *overlay) {
+    CairoRenderer *r = &overlay->cairo;
+    Display *display = overlay->display;
+    memset(r, 0, sizeof(*r));
+
+    // --- Setup Present ---
+    Drawable target = overlay->window;
+#ifdef HAVE_XPRESENT
+    int present_event, present_error, present_major = 1, present_minor = 0;
+    if (XPresentQueryExtension(display, &r->present_opcode, &present_event, &present_error) &&
+        XPresentQueryVersion(display, &present_major, &present_minor)) {
+        r->back = XCreatePixmap(display, overlay->window, overlay->width, overlay->height, overlay->depth);
+        XPresentSelectInput(display, overlay->window, PresentCompleteNotifyMask | PresentIdleNotifyMask);
+        r->present = 1;
+        target = r->back;
+    } else {
+        fprintf(stderr, "Warning: Present extension not available. Frames will not be vblank-synced.\n");
+    }
+#endif
+
+    // --- Setup Cairo ---
+    r->surface = cairo_xlib_surface_create(display, target, overlay->visual, overlay->width, overlay->height);
+    if (!r->surface || cairo_surface_status(r->surface) != CAIRO_STATUS_SUCCESS) { /* ... error handling ... */
+         fprintf(stderr, "Error creating Cairo surface: %s\n", cairo_status_to_string(cairo_surface_status(r->surface)));
+         cairo_backend_destroy(overlay); return -1;
+    }
+    r->cr = cairo_create(r->surface);
+    if (!r->cr || cairo_status(r->cr) != CAIRO_STATUS_SUCCESS) { /* ... error handling ... */
+        fprintf(stderr, "Error creating Cairo context: %s\n", cairo_status_to_string(cairo_status(r->cr)));
+        cairo_backend_destroy(overlay); return -1;
+    }
+
+    if (sprites_create(&r->sprites, r->surface) != 0) {
+        cairo_backend_destroy(overlay); return -1;
+    }
+
+    // A new pixmap holds garbage; damage tracking assumes it starts transparent
+    if (r->present) {
+        cairo_set_source_rgba(r->cr, 0, 0, 0, 0);
+        cairo_set_operator(r->cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(r->cr);
+        cairo_set_operator(r->cr, CAIRO_OPERATOR_OVER);
+    }
+    return 0;
+}
+
+// With Present, a frame that is still in flight (or whose events got lost)
+// times out after PRESENT_TIMEOUT_MS
+uint64_t cairo_backend_deadline(const Overlay *overlay) {
+    const CairoRenderer *r = &overlay->cairo;
+    if (!r->present || (!r->complete_pending && !r->idle_pending)) return 0;
+    return r->presented_ns + PRESENT_TIMEOUT_MS * 1000000ull;
+}
+
+// With Present, no new frame while one is in flight
+int cairo_backend_ready(const Overlay *overlay) {
+    uint64_t deadline = cairo_backend_deadline(overlay);
+    return !deadline || now_ns(CLOCK_MONOTONIC) >= deadline;
+}
+
+void cairo_backend_event(Overlay *overlay, XEvent *ev) {
+#ifdef HAVE_XPRESENT
+    CairoRenderer *r = &overlay->cairo;
+    XGenericEventCookie *cookie = &ev->xcookie;
+    if (cookie->type != GenericEvent || cookie->extension != r->present_opcode || !cookie->data) return;
+    if (cookie->evtype == PresentCompleteNotify) {
+        XPresentCompleteNotifyEvent *complete = cookie->data;
+        if (complete->window == overlay->window && complete->serial_number == r->present_serial) {
+            r->complete_pending = 0;
+        }
+    } else if (cookie->evtype == PresentIdleNotify) {
+        XPresentIdleNotifyEvent *idle = cookie->data;
+        if (idle->window == overlay->window && idle->pixmap == r->back &&
+            idle->serial_number == r->present_serial) {
+            r->idle_pending = 0;
+        }
+    }
+#else
+    (void)overlay; (void)ev;
+#endif
+}
+
+// Repaint the trail and push it to the screen
+void cairo_backend_draw(Overlay *overlay, const Trail *trail) {
+    CairoRenderer *r = &overlay->cairo;
+    Damage before = r->drawn;
+
+    // Repaint the part of the overlay the trail moved over
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    draw_trail(r->cr, trail, &r->sprites, &r->drawn, overlay->x, overlay->y, overlay->width, overlay->height);
+    uint64_t drawn_ns = now_ns(CLOCK_MONOTONIC);
+    hist_record(&stats.draw, drawn_ns - start_ns);
+
+    // Flush drawing to the screen
+    cairo_surface_flush(r->surface);
+
+#ifdef HAVE_XPRESENT
+    if (r->present && (before.count || r->drawn.count)) {
+        // Copy only the repainted area from the back pixmap at the next vblank.
+        // PresentOptionCopy: a flip would keep 'back' on screen, so
+        // PresentIdleNotify would wait for a frame that is never presented.
+        XRectangle rects[2 * DAMAGE_MAX_RECTS];
+        int n = 0;
+        const Damage *lists[2] = { &before, &r->drawn };
+        for (int l = 0; l < 2; ++l) {
+            for (int i = 0; i < lists[l]->count; ++i) {
+                const DirtyRect *d = &lists[l]->rects[i];
+                rects[n].x = d->x1; rects[n].y = d->y1;
+                rects[n].width = d->x2 - d->x1; rects[n].height = d->y2 - d->y1;
+                n++;
+            }
+        }
+        XserverRegion update = XFixesCreateRegion(overlay->display, rects, n);
+        XPresentPixmap(overlay->display, overlay->window, r->back, ++r->present_serial,
+                       None, update, 0, 0, None, None, None, PresentOptionCopy,
+                       0, 1, 0, NULL, 0); // target_msc 0, divisor 1: the next vblank
+        XFixesDestroyRegion(overlay->display, update);
+        r->complete_pending = r->idle_pending = 1;
+        r->presented_ns = now_ns(CLOCK_MONOTONIC);
+    }
+#else
+    (void)before;
+#endif
+    XFlush(overlay->display);
+    hist_record(&stats.flush, now_ns(CLOCK_MONOTONIC) - drawn_ns);
+}
+
+const RenderBackend cairo_backend = {
+    "cairo", cairo_backend_init, cairo_backend_destroy,
+    cairo_backend_ready, cairo_backend_event, cairo_backend_draw, cairo_backend_deadline,
+};
+
+// --- XShm Renderer ---
+
+void xshm_backend_destroy(Overlay *overlay) {
+    XShmRenderer *r = &overlay->xshm;
+    sprites_destroy(&r->sprites);
+    if (r->cr) cairo_destroy(r->cr);
+    if (r->surface) cairo_surface_destroy(r->surface);
+    if (r->image) {
+        if (r->shminfo.shmaddr) {
+            XShmDetach(overlay->display, &r->shminfo);
+            XSync(overlay->display, False); // Server lets go before we unmap
+            shmdt(r->shminfo.shmaddr);
+        }
+        r->image->data = NULL; // Not ours to free()
+        XDestroyImage(r->image);
+    }
+    if (r->gc) XFreeGC(overlay->display, r->gc);
+    memset(r, 0, sizeof(*r));
+}
+
+int xshm_backend_init(Overlay *overlay) {
+    XShmRenderer *r = &overlay->xshm;
+    Display *display = overlay->display;
+    memset(r, 0, sizeof(*r));
+
+    // cairo's ARGB32 is the 32-bit visual's native layout only with these masks
+    if (!XShmQueryExtension(display) || overlay->visual->red_mask != 0xff0000 ||
+        overlay->visual->green_mask != 0xff00 || overlay->visual->blue_mask != 0xff) {
+        fprintf(stderr, "Warning: MIT-SHM not available for the overlay visual.\n");
+        return -1;
+    }
+
+    // --- Shared Image ---
+    r->image = XShmCreateImage(display, overlay->visual, overlay->depth, ZPixmap, NULL,
+                               &r->shminfo, overlay->width, overlay->height);
+    if (!r->image || r->image->bits_per_pixel != 32) {
+        fprintf(stderr, "Warning: Could not create a shared 32-bit image.\n");
+        xshm_backend_destroy(overlay); return -1;
+    }
+    r->shminfo.shmid = shmget(IPC_PRIVATE, (size_t)r->image->bytes_per_line * r->image->height,
+                              IPC_CREAT | 0600);
+    if (r->shminfo.shmid < 0) {
+        perror("shmget");
+        xshm_backend_destroy(overlay); return -1;
+    }
+    r->shminfo.shmaddr = r->image->data = shmat(r->shminfo.shmid, NULL, 0);
+    if (r->shminfo.shmaddr == (char *)-1) {
+        perror("shmat");
+        shmctl(r->shminfo.shmid, IPC_RMID, NULL);
+        r->shminfo.shmaddr = r->image->data = NULL;
+        xshm_backend_destroy(overlay); return -1;
+    }
+    r->shminfo.readOnly = True;
+    int attached = XShmAttach(display, &r->shminfo);
+    XSync(display, False);
+    // Freed as soon as both sides detach, even if we crash
+    shmctl(r->shminfo.shmid, IPC_RMID, NULL);
+    if (!attached) {
+        fprintf(stderr, "Warning: X server could not attach the shared segment (remote display?).\n");
+        shmdt(r->shminfo.shmaddr);
+        r->shminfo.shmaddr = r->image->data = NULL;
+        xshm_backend_destroy(overlay); return -1;
+    }
+    memset(r->image->data, 0, (size_t)r->image->bytes_per_line * r->image->height);
+    r->completion_type = XShmGetEventBase(display) + ShmCompletion;
+    r->gc = XCreateGC(display, overlay->window, 0, NULL);
+
+    // --- Setup Cairo ---
+    r->surface = cairo_image_surface_create_for_data((unsigned char *)r->image->data, CAIRO_FORMAT_ARGB32,
+                                                     overlay->width, overlay->height,
+                                                     r->image->bytes_per_line);
+    r->cr = cairo_create(r->surface);
+    if (cairo_status(r->cr) != CAIRO_STATUS_SUCCESS || sprites_create(&r->sprites, r->surface) != 0) {
+        fprintf(stderr, "Error creating Cairo image surface: %s\n", cairo_status_to_string(cairo_status(r->cr)));
+        xshm_backend_destroy(overlay); return -1;
+    }
+    return 0;
+}
+
+int xshm_backend_ready(const Overlay *overlay) {
+    return !overlay->xshm.frame_pending;
+}
+
+void xshm_backend_event(Overlay *overlay, XEvent *ev) {
+    XShmRenderer *r = &overlay->xshm;
+    if (ev->type == r->completion_type && ((XShmCompletionEvent *)ev)->drawable == overlay->window) {
+        r->frame_pending = 0;
+    }
+}
+
+void xshm_backend_draw(Overlay *overlay, const Trail *trail) {
+    XShmRenderer *r = &overlay->xshm;
+    Damage upload = r->drawn;
+
+    // Repaint the part of the overlay the trail moved over
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    draw_trail(r->cr, trail, &r->sprites, &r->drawn, overlay->x, overlay->y, overlay->width, overlay->height);
+    cairo_surface_flush(r->surface);
+    uint64_t drawn_ns = now_ns(CLOCK_MONOTONIC);
+    hist_record(&stats.draw, drawn_ns - start_ns);
+
+    // Upload the old and new dots: cleared pixels and painted ones
+    for (int i = 0; i < r->drawn.count; ++i) {
+        const DirtyRect *d = &r->drawn.rects[i];
+        damage_add(&upload, d->x1, d->y1, d->x2, d->y2, overlay->width, overlay->height);
+    }
+    for (int i = 0; i < upload.count; ++i) {
+        const DirtyRect *d = &upload.rects[i];
+        int last = (i == upload.count - 1); // One completion event per frame
+        XShmPutImage(overlay->display, overlay->window, r->gc, r->image, d->x1, d->y1, d->x1, d->y1,
+                     d->x2 - d->x1, d->y2 - d->y1, last ? True : False);
+    }
+    if (upload.count) r->frame_pending = 1;
+    XFlush(overlay->display);
+    hist_record(&stats.flush, now_ns(CLOCK_MONOTONIC) - drawn_ns);
+}
+
+const RenderBackend xshm_backend = {
+    "xshm", xshm_backend_init, xshm_backend_destroy,
+    xshm_backend_ready, xshm_backend_event, xshm_backend_draw, NULL,
+};
+
+#ifdef HAVE_EGL
+// --- EGL Renderer ---
+
+// Point sprites: one vertex per trail slot. Age (and so alpha) comes from
+// the slot's distance behind head, exactly as in draw_trail. Instance k > 0
+// is the k-th dot from the slot towards the next newer one, the predicted
+// head for the newest slot, with the same spacing rule as
+// trail_segment_steps; dot k == steps is the predicted head itself.
+static const char *egl_vertex_shader =
+    "#version 300 es\n"
+    "in float a_x;\n"
+    "in float a_y;\n"
+    "in float a_flags;\n"
+    "in float a_next_x;\n" // The next slot (newer by one)
+    "in float a_next_y;\n"
+    "in float a_next_flags;\n"
+    "uniform uint u_head;\n"
+    "uniform uint u_mask;\n"
+    "uniform float u_length;\n"
+    "uniform uint u_visible;\n"
+    "uniform uint u_steps;\n" // TRAIL_INTERP_STEPS with --interpolate, else 1
+    "uniform vec3 u_lead;\n"  // Predicted head; z: 1 if shown
+    "uniform vec2 u_origin;\n"
+    "uniform vec2 u_screen;\n"
+    "out vec4 v_color;\n"
+    "void main() {\n"
+    "    uint age = (u_head - 1u - uint(gl_VertexID)) & u_mask;\n"
+    "    uint k = uint(gl_InstanceID);\n"
+    "    int flags = int(a_flags);\n"
+    "    vec2 p = vec2(a_x, a_y);\n"
+    "    float alpha = 1.0 - float(age) / u_length;\n"
+    "    bool clicked = (flags & 2) != 0;\n"
+    "    bool hidden = (flags & 1) == 0 || age >= u_visible;\n"
+    "    if (k > 0u && !hidden) {\n"
+    "        bool lead = age == 0u;\n"
+    "        vec2 q = lead ? u_lead.xy : vec2(a_next_x, a_next_y);\n"
+    "        int next_flags = lead ? (u_lead.z > 0.0 ? flags : 0) : int(a_next_flags);\n"
+    "        float d = distance(p, q);\n"
+    "        uint steps = 1u;\n"
+    "        if (d > TRAIL_INTERP_SPACING && d <= TRAIL_INTERP_MAX_DIST)\n"
+    "            steps = min(uint(ceil(d / TRAIL_INTERP_SPACING)), u_steps);\n"
+    "        hidden = (next_flags & 1) == 0 || k > steps || (k == steps && !lead);\n"
+    "        float t = float(k) / float(steps);\n"
+    "        p = mix(p, q, t);\n"
+    "        alpha = mix(alpha, lead ? 1.0 : alpha + 1.0 / u_length, t);\n"
+    "        clicked = clicked && (next_flags & 2) != 0;\n"
+    "    }\n"
+    "    if (hidden) {\n"
+    "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n" // Outside the clip volume
+    "        gl_PointSize = 1.0;\n"
+    "        return;\n"
+    "    }\n"
+    "    vec3 rgb = clicked ? vec3(CLICK_R, CLICK_G, CLICK_B) : vec3(TRAIL_R, TRAIL_G, TRAIL_B);\n"
+    "    float a = alpha * (clicked ? 0.9 : 0.8);\n"
+    "    v_color = vec4(rgb * a, a);\n" // Premultiplied, as the compositor expects
+    "    p -= u_origin;\n"
+    "    gl_Position = vec4(p.x / u_screen.x * 2.0 - 1.0, 1.0 - p.y / u_screen.y * 2.0, 0.0, 1.0);\n"
+    "    gl_PointSize = 2.0 * (TRAIL_RADIUS + 1.0);\n"
+    "}\n";
+
+static const char *egl_fragment_shader =
+    "#version 300 es\n"
+    "precision mediump float;\n"
+    "in vec4 v_color;\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "    float d = length(gl_PointCoord - 0.5) * 2.0 * (TRAIL_RADIUS + 1.0);\n"
+    "    frag_color = v_color * clamp(TRAIL_RADIUS + 0.5 - d, 0.0, 1.0);\n" // Anti-aliased edge
+    "}\n";
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+GLuint egl_compile(GLenum type, const char *body) {
+    // Feed the configuration into the shader as constants
+    const char *defines =
+        "#define TRAIL_R float(" STR(TRAIL_R) ")\n#define TRAIL_G float(" STR(TRAIL_G) ")\n"
+        "#define TRAIL_B float(" STR(TRAIL_B) ")\n#define CLICK_R float(" STR(CLICK_R) ")\n"
+        "#define CLICK_G float(" STR(CLICK_G) ")\n#define CLICK_B float(" STR(CLICK_B) ")\n"
+        "#define TRAIL_RADIUS float(" STR(TRAIL_RADIUS) ")\n"
+        "#define TRAIL_INTERP_SPACING float(" STR(TRAIL_INTERP_SPACING) ")\n"
+        "#define TRAIL_INTERP_MAX_DIST float(" STR(TRAIL_INTERP_MAX_DIST) ")\n";
+    // #version must stay the first line
+    const char *newline = strchr(body, '\n') + 1;
+    const char *sources[3] = { body, defines, newline };
+    GLint lengths[3] = { (GLint)(newline - body), -1, -1 };
+
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 3, sources, lengths);
+    glCompileShader(shader);
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Error compiling shader: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Only one overlay's swaps wait for vblank. That paces the render loop; if
+// every monitor's swap waited too, a frame would cost one refresh per monitor.
+// The compositor still shows the others tear-free.
+int egl_vsync_taken;
+
+// The EGLDisplay belongs to the X connection and is shared by all overlays,
+// so it is not terminated here
+void egl_backend_destroy(Overlay *overlay) {
+    EGLRenderer *r = &overlay->egl;
+    if (r->vsync) egl_vsync_taken = 0;
+    if (r->context != EGL_NO_CONTEXT && r->context) {
+        eglMakeCurrent(r->display, r->surface, r->surface, r->context);
+        if (r->program) glDeleteProgram(r->program);
+        if (r->capacity) glDeleteBuffers(3, r->vbo);
+        eglMakeCurrent(r->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(r->display, r->context);
+    }
+    if (r->surface != EGL_NO_SURFACE && r->surface) eglDestroySurface(r->display, r->surface);
+    memset(r, 0, sizeof(*r));
+}
+
+int egl_backend_init(Overlay *overlay) {
+    EGLRenderer *r = &overlay->egl;
+    memset(r, 0, sizeof(*r));
+
+    r->display = eglGetDisplay((EGLNativeDisplayType)overlay->display);
+    if (r->display == EGL_NO_DISPLAY || !eglInitialize(r->display, NULL, NULL)) {
+        fprintf(stderr, "Warning: Could not initialize EGL.\n");
+        memset(r, 0, sizeof(*r));
+        return -1;
+    }
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    // The config must match the overlay's 32-bit ARGB visual, or the
+    // compositor would get an opaque window
+    const EGLint attribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig configs[64], config = NULL;
+    EGLint nconfigs = 0;
+    eglChooseConfig(r->display, attribs, configs, 64, &nconfigs);
+    VisualID visual_id = XVisualIDFromVisual(overlay->visual);
+    for (int i = 0; i < nconfigs; ++i) {
+        EGLint id;
+        if (eglGetConfigAttrib(r->display, configs[i], EGL_NATIVE_VISUAL_ID, &id) && (VisualID)id == visual_id) {
+            config = configs[i];
+            break;
+        }
+    }
+    if (!config) {
+        fprintf(stderr, "Warning: No EGL config matches the overlay visual.\n");
+        egl_backend_destroy(overlay); return -1;
+    }
+
+    r->surface = eglCreateWindowSurface(r->display, config, (EGLNativeWindowType)overlay->window, NULL);
+    const EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    r->context = eglCreateContext(r->display, config, EGL_NO_CONTEXT, context_attribs);
+    if (r->surface == EGL_NO_SURFACE || r->context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(r->display, r->surface, r->surface, r->context)) {
+        fprintf(stderr, "Warning: Could not create an EGL surface/context (0x%x).\n", eglGetError());
+        egl_backend_destroy(overlay); return -1;
+    }
+    // Swap at vblank: at most one frame per refresh
+    r->vsync = !egl_vsync_taken;
+    egl_vsync_taken = 1;
+    eglSwapInterval(r->display, r->vsync ? 1 : 0);
+
+    // --- Shaders ---
+    GLuint vs = egl_compile(GL_VERTEX_SHADER, egl_vertex_shader);
+    GLuint fs = egl_compile(GL_FRAGMENT_SHADER, egl_fragment_shader);
+    if (!vs || !fs) {
+        if (vs) glDeleteShader(vs);
+        if (fs) glDeleteShader(fs);
+        egl_backend_destroy(overlay); return -1;
+    }
+    r->program = glCreateProgram();
+    glAttachShader(r->program, vs);
+    glAttachShader(r->program, fs);
+    glBindAttribLocation(r->program, 0, "a_x");
+    glBindAttribLocation(r->program, 1, "a_y");
+    glBindAttribLocation(r->program, 2, "a_flags");
+    glBindAttribLocation(r->program, 3, "a_next_x");
+    glBindAttribLocation(r->program, 4, "a_next_y");
+    glBindAttribLocation(r->program, 5, "a_next_flags");
+    glLinkProgram(r->program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint linked;
+    glGetProgramiv(r->program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        fprintf(stderr, "Error linking shader program.\n");
+        egl_backend_destroy(overlay); return -1;
+    }
+    glUseProgram(r->program);
+    r->u_head = glGetUniformLocation(r->program, "u_head");
+    r->u_mask = glGetUniformLocation(r->program, "u_mask");
+    r->u_length = glGetUniformLocation(r->program, "u_length");
+    r->u_visible = glGetUniformLocation(r->program, "u_visible");
+    r->u_origin = glGetUniformLocation(r->program, "u_origin");
+    r->u_screen = glGetUniformLocation(r->program, "u_screen");
+    r->u_steps = glGetUniformLocation(r->program, "u_steps");
+    r->u_lead = glGetUniformLocation(r->program, "u_lead");
+    glUniform2f(r->u_origin, (GLfloat)overlay->x, (GLfloat)overlay->y);
+    glUniform2f(r->u_screen, (GLfloat)overlay->width, (GLfloat)overlay->height);
+
+    glViewport(0, 0, overlay->width, overlay->height);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // Premultiplied OVER
+    glClearColor(0, 0, 0, 0);
+    return 0;
+}
+
+// eglSwapBuffers already waits for vblank
+int egl_backend_ready(const Overlay *overlay) {
+    (void)overlay;
+    return 1;
+}
+
+void egl_backend_event(Overlay *overlay, XEvent *ev) {
+    (void)overlay; (void)ev;
+}
+
+// Upload slots [from, to) of one trail array into its vertex buffer. Slot 0
+// is also kept after the last one, where the last slot's a_next_* reads it.
+void egl_upload_range(GLuint vbo, const void *data, size_t elem, unsigned int mask,
+                      unsigned int from, unsigned int to) {
+    unsigned int start = from & mask, count = to - from;
+    unsigned int first = count < mask + 1 - start ? count : mask + 1 - start;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, start * elem, first * elem, (const char *)data + start * elem);
+    if (count > first) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (count - first) * elem, data);
+    }
+    if (start == 0 || count > first) glBufferSubData(GL_ARRAY_BUFFER, (mask + 1) * elem, elem, data);
+}
+
+// Allocate one trail array's vertex buffer and point the slot's attribute
+// and its a_next_* neighbour at it
+void egl_alloc_array(GLuint vbo, GLuint index, GLenum type, const void *data, size_t elem, unsigned int capacity) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, (capacity + 1) * elem, NULL, GL_DYNAMIC_DRAW);
+    egl_upload_range(vbo, data, elem, capacity - 1, 0, capacity);
+    glVertexAttribPointer(index, 1, type, GL_FALSE, 0, NULL);
+    glVertexAttribPointer(index + 3, 1, type, GL_FALSE, 0, (const void *)elem);
+    glEnableVertexAttribArray(index);
+    glEnableVertexAttribArray(index + 3);
+}
+
+void egl_backend_draw(Overlay *overlay, const Trail *trail) {
+    EGLRenderer *r = &overlay->egl;
+    unsigned int capacity = trail->mask + 1;
+
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    eglMakeCurrent(r->display, r->surface, r->surface, r->context); // One context per overlay
+    // (Re)allocate the buffers on first use; then only upload new slots
+    if (r->capacity != capacity) {
+        if (r->capacity) glDeleteBuffers(3, r->vbo);
+        glGenBuffers(3, r->vbo);
+        egl_alloc_array(r->vbo[0], 0, GL_SHORT, trail->x, sizeof(int16_t), capacity);
+        egl_alloc_array(r->vbo[1], 1, GL_SHORT, trail->y, sizeof(int16_t), capacity);
+        egl_alloc_array(r->vbo[2], 2, GL_UNSIGNED_BYTE, trail->flags, 1, capacity);
+        r->capacity = capacity;
+        r->uploaded_head = trail->head;
+    } else if (trail->head != r->uploaded_head) {
+        unsigned int from = trail->head - r->uploaded_head > capacity ? trail->head - capacity : r->uploaded_head;
+        egl_upload_range(r->vbo[0], trail->x, sizeof(int16_t), trail->mask, from, trail->head);
+        egl_upload_range(r->vbo[1], trail->y, sizeof(int16_t), trail->mask, from, trail->head);
+        egl_upload_range(r->vbo[2], trail->flags, 1, trail->mask, from, trail->head);
+        r->uploaded_head = trail->head;
+    }
+
+    glUniform1ui(r->u_head, trail->head);
+    glUniform1ui(r->u_mask, trail->mask);
+    glUniform1f(r->u_length, (GLfloat)trail->length);
+    glUniform1ui(r->u_visible, trail_visible(trail));
+    glUniform1ui(r->u_steps, trail->interpolate ? TRAIL_INTERP_STEPS : 1);
+    glUniform3f(r->u_lead, trail->lead_x, trail->lead_y, trail->lead ? 1.0f : 0.0f);
+
+    // Instance 0 draws the points; the others the dots between them, and
+    // the predicted head
+    GLsizei instances = trail->interpolate ? TRAIL_INTERP_STEPS + 1 : trail->lead ? 2 : 1;
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawArraysInstanced(GL_POINTS, 0, (GLsizei)capacity, instances);
+    uint64_t drawn_ns = now_ns(CLOCK_MONOTONIC);
+    hist_record(&stats.draw, drawn_ns - start_ns);
+    eglSwapBuffers(r->display, r->surface);
+    hist_record(&stats.flush, now_ns(CLOCK_MONOTONIC) - drawn_ns);
+}
+
+const RenderBackend egl_backend = {
+    "egl", egl_backend_init, egl_backend_destroy,
+    egl_backend_ready, egl_backend_event, egl_backend_draw, NULL,
+};
+#endif
+
+// --- Heatmap Renderer ---
+
+void heatmap_backend_destroy(Overlay *overlay) {
+    HeatmapRenderer *r = &overlay->heat;
+    if (r->cr) cairo_destroy(r->cr);
+    if (r->surface) cairo_surface_destroy(r->surface);
+    memset(r, 0, sizeof(*r));
+}
+
+int heatmap_backend_init(Overlay *overlay) {
+    HeatmapRenderer *r = &overlay->heat;
+    memset(r, 0, sizeof(*r));
+    r->surface = cairo_xlib_surface_create(overlay->display, overlay->window, overlay->visual,
+                                           overlay->width, overlay->height);
+    if (!r->surface || cairo_surface_status(r->surface) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Error creating Cairo surface: %s\n", cairo_status_to_string(cairo_surface_status(r->surface)));
+        heatmap_backend_destroy(overlay); return -1;
+    }
+    r->cr = cairo_create(r->surface);
+    if (!r->cr || cairo_status(r->cr) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Error creating Cairo context: %s\n", cairo_status_to_string(cairo_status(r->cr)));
+        heatmap_backend_destroy(overlay); return -1;
+    }
+    cairo_set_operator(r->cr, CAIRO_OPERATOR_SOURCE);
+    r->full = 1;
+    return 0;
+}
+
+int heatmap_backend_ready(const Overlay *overlay) {
+    (void)overlay;
+    return 1;
+}
+
+void heatmap_backend_event(Overlay *overlay, XEvent *ev) {
+    (void)overlay; (void)ev;
+}
+
+// Upload the tiles on this monitor changed since the last frame, or all of
+// them on the first. The trail is drawn by the pointer's own overlays.
+void heatmap_backend_draw(Overlay *overlay, const Trail *trail) {
+    (void)trail;
+    HeatmapRenderer *r = &overlay->heat;
+    const Heatmap *hm = overlay->heatmap;
+    if (!hm) return;
+
+    uint64_t start_ns = now_ns(CLOCK_MONOTONIC);
+    int span = HEATMAP_TILE * hm->cell;
+    int count = r->full ? hm->tiles_x * hm->tiles_y : hm->ndirty;
+    for (int i = 0; i < count; ++i) {
+        int tile = r->full ? i : hm->dirty[i];
+        int x = (tile % hm->tiles_x) * span - overlay->x;
+        int y = (tile / hm->tiles_x) * span - overlay->y;
+        if (x >= overlay->width || y >= overlay->height || x + span <= 0 || y + span <= 0) continue;
+
+        cairo_save(r->cr);
+        cairo_rectangle(r->cr, x, y, span, span);
+        cairo_clip(r->cr);
+        cairo_translate(r->cr, -overlay->x, -overlay->y);
+        cairo_scale(r->cr, hm->cell, hm->cell);
+        cairo_set_source_surface(r->cr, hm->image, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(r->cr), CAIRO_FILTER_NEAREST);
+        cairo_paint(r->cr);
+        cairo_restore(r->cr);
+    }
+    r->full = 0;
+    uint64_t drawn_ns = now_ns(CLOCK_MONOTONIC);
+    hist_record(&stats.draw, drawn_ns - start_ns);
+
+    cairo_surface_flush(r->surface);
+    XFlush(overlay->display);
+    hist_record(&stats.flush, now_ns(CLOCK_MONOTONIC) - drawn_ns);
+}
+
+// Not a --renderer choice: it draws the heatmap layer, not trails
+const RenderBackend heatmap_backend = {
+    "heatmap", heatmap_backend_init, heatmap_backend_destroy,
+    heatmap_backend_ready, heatmap_backend_event, heatmap_backend_draw, NULL,
+};
+
+// Backends in order of preference for --renderer
+const RenderBackend *render_backends[] = {
+    &cairo_backend,
+    &xshm_backend,
+#ifdef HAVE_EGL
+    &egl_backend,
+#endif
+    NULL
+};
+
+const RenderBackend *render_backend_find(const char *name) {
+    for (int i = 0; render_backends[i]; ++i) {
+        if (strcmp(render_backends[i]->name, name) == 0) return render_backends[i];
+    }
+    return NULL;
+}
+
+// --- Overlay ---
+
+void overlay_destroy(Overlay *overlay) {
+    if (overlay->backend) overlay->backend->destroy(overlay);
+    if (overlay->colormap) XFreeColormap(overlay->display, overlay->colormap);
+    if (overlay->window) {
+        XUnmapWindow(overlay->display, overlay->window);
+        XDestroyWindow(overlay->display, overlay->window);
+    }
+    memset(overlay, 0, sizeof(*overlay));
+}
+
+// Start a render backend on the overlay, falling back to cairo if the
+// requested trail renderer can't start. Returns 0 on success, -1 on error.
+int overlay_start_backend(Overlay *overlay, const RenderBackend *backend) {
+    if (backend->init(overlay) != 0) {
+        if (backend == &cairo_backend || backend == &heatmap_backend || cairo_backend.init(overlay) != 0) return -1;
+        fprintf(stderr, "Warning: %s renderer unavailable, using cairo.\n", backend->name);
+        backend = &cairo_backend;
+    }
+    overlay->backend = backend;
+    overlay->dirty = 1;
+    return 0;
+}
+
+// Create and map an overlay window covering 'monitor' with the display's
+// 32-bit visual and start the render backend on it. Nothing here waits for
+// the server until the backend starts.
+// Returns 0 on success, -1 on error (nothing is left allocated).
+int overlay_create(Overlay *overlay, const OverlayDisplay *od, const Monitor *monitor,
+                   const RenderBackend *backend) {
+    Display *display = od->display;
+    Window root_window = RootWindow(display, od->screen);
+    XSetWindowAttributes attrs;
+
+    memset(overlay, 0, sizeof(*overlay));
+    overlay->display = display;
+    overlay->visual = od->vinfo.visual; overlay->depth = od->vinfo.depth;
+    overlay->x = monitor->x;
+    overlay->y = monitor->y;
+    overlay->width = monitor->width;
+    overlay->height = monitor->height;
+
+    // --- Create Colormap ---
+    overlay->colormap = XCreateColormap(display, root_window, overlay->visual, AllocNone);
+
+    // --- Set Window Attributes ---
+    attrs.override_redirect = True; attrs.colormap = overlay->colormap;
+    attrs.background_pixel = 0; attrs.border_pixel = 0;
+    unsigned long valuemask = CWOverrideRedirect | CWColormap | CWBackPixel | CWBorderPixel;
+
+    // --- Create Overlay Window ---
+    overlay->window = XCreateWindow(display, root_window, overlay->x, overlay->y,
+                                    overlay->width, overlay->height, 0,
+                                    overlay->depth, InputOutput, overlay->visual, valuemask, &attrs);
+    Window overlay_window = overlay->window;
+
+    // --- Set EWMH Properties ---
+    const Atom *atoms = od->atoms;
+    if (atoms[ATOM_NET_WM_STATE] != None && atoms[ATOM_NET_WM_STATE_ABOVE] != None) {
+        XChangeProperty(display, overlay_window, atoms[ATOM_NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)&atoms[ATOM_NET_WM_STATE_ABOVE], 1);
+    }
+    if (atoms[ATOM_NET_WM_WINDOW_TYPE] != None && atoms[ATOM_NET_WM_WINDOW_TYPE_DOCK] != None) {
+        XChangeProperty(display, overlay_window, atoms[ATOM_NET_WM_WINDOW_TYPE], XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)&atoms[ATOM_NET_WM_WINDOW_TYPE_DOCK], 1);
+    }
+
+    // --- Enable Click-Through ---
+    if (od->xfixes) {
+        XserverRegion region = XFixesCreateRegion(display, NULL, 0);
+        XFixesSetWindowShapeRegion(display, overlay_window, ShapeInput, 0, 0, region);
+        XFixesDestroyRegion(display, region);
+    }
+
+    // --- Map Window & Flush ---
+    XMapWindow(display, overlay_window);
+    XFlush(display);
+
+    // --- Start Renderer ---
+    if (overlay_start_backend(overlay, backend) != 0) {
+        overlay_destroy(overlay); return -1;
+    }
+    return 0;
+}
+
+// Follow a monitor that moved or changed resolution. The backend's surfaces
+// are sized to the window, so it is restarted on the new geometry.
+// Returns 0 on success, -1 on error (the overlay is destroyed).
+int overlay_resize(Overlay *overlay, const Monitor *monitor) {
+    const RenderBackend *backend = overlay->backend;
+
+    backend->destroy(overlay);
+    overlay->backend = NULL;
+    overlay->x = monitor->x;
+    overlay->y = monitor->y;
+    overlay->width = monitor->width;
+    overlay->height = monitor->height;
+    XMoveResizeWindow(overlay->display, overlay->window, overlay->x, overlay->y,
+                      overlay->width, overlay->height);
+
+    if (overlay_start_backend(overlay, backend) != 0) {
+        overlay_destroy(overlay); return -1;
+    }
+    return 0;
+}
+
+// --- Overlay Set (one overlay per monitor) ---
+
+int monitor_contains(const Monitor *monitor, int x, int y) {
+    return x >= monitor->x && x < monitor->x + monitor->width &&
+           y >= monitor->y && y < monitor->y + monitor->height;
+}
+
+// Read the current monitor layout. Without RandR 1.5 the whole screen is
+// one monitor.
+void overlay_display_load_monitors(OverlayDisplay *od) {
+    int count = 0;
+    if (od->randr) {
+        int n = 0;
+        XRRMonitorInfo *info = XRRGetMonitors(od->display, RootWindow(od->display, od->screen), True, &n);
+        for (int i = 0; i < n && count < OVERLAY_MAX_MONITORS; ++i) {
+            if (info[i].width <= 0 || info[i].height <= 0) continue;
+            od->monitors[count].name = info[i].name;
+            od->monitors[count].x = info[i].x;
+            od->monitors[count].y = info[i].y;
+            od->monitors[count].width = info[i].width;
+            od->monitors[count].height = info[i].height;
+            count++;
+        }
+        if (info) XRRFreeMonitors(info);
+    }
+    if (count == 0) {
+        od->monitors[0].name = None;
+        od->monitors[0].x = 0;
+        od->monitors[0].y = 0;
+        od->monitors[0].width = DisplayWidth(od->display, od->screen);
+        od->monitors[0].height = DisplayHeight(od->display, od->screen);
+        count = 1;
+    }
+    od->count = count;
+}
+
+// Find the 32-bit visual. Needs a 32-bit TrueColor visual, i.e. a running
+// compositor. No request goes to the server.
+// Returns 0 on success, -1 on error.
+int overlay_display_init(OverlayDisplay *od, Display *display, int screen) {
+    memset(od, 0, sizeof(*od));
+    od->display = display;
+    od->screen = screen;
+
+    XVisualInfo vinfo_template;
+    vinfo_template.screen = screen; vinfo_template.depth = 32; vinfo_template.class = TrueColor;
+    int nitems;
+    XVisualInfo *vinfo_list = XGetVisualInfo(display, VisualScreenMask | VisualDepthMask | VisualClassMask, &vinfo_template, &nitems);
+    if (!vinfo_list || nitems == 0) { /* ... error handling ... */
+        fprintf(stderr, "Error: No 32-bit TrueColor visual found. Is a compositor running? (Try --no-overlay)\n");
+        return -1;
+    }
+    od->vinfo = vinfo_list[0];
+    XFree(vinfo_list);
+    return 0;
+}
+
+// Everything else overlays need from the server, in as few round trips as
+// Xlib allows: all atoms in one XInternAtoms, each extension once per
+// display rather than once per overlay set. Called before the first
+// overlay window is created.
+void overlay_display_query(OverlayDisplay *od) {
+    if (od->queried) return;
+    od->queried = 1;
+
+    char *names[OVERLAY_ATOMS] = {
+        [ATOM_NET_WM_STATE] = "_NET_WM_STATE", [ATOM_NET_WM_STATE_ABOVE] = "_NET_WM_STATE_ABOVE",
+        [ATOM_NET_WM_WINDOW_TYPE] = "_NET_WM_WINDOW_TYPE", [ATOM_NET_WM_WINDOW_TYPE_DOCK] = "_NET_WM_WINDOW_TYPE_DOCK",
+    };
+    if (!XInternAtoms(od->display, names, OVERLAY_ATOMS, False, od->atoms)) {
+        for (int i = 0; i < OVERLAY_ATOMS; ++i) od->atoms[i] = None; // Windows just get no hints
+    }
+
+    int fix_event_base, fix_error_base;
+    od->xfixes = XFixesQueryExtension(od->display, &fix_event_base, &fix_error_base);
+    if (!od->xfixes) {
+        fprintf(stderr, "Warning: XFixes extension not available. Overlay will not be click-through.\n");
+    }
+
+    int randr_error_base, major = 1, minor = 5;
+    if (XRRQueryExtension(od->display, &od->randr_event_base, &randr_error_base) &&
+        XRRQueryVersion(od->display, &major, &minor) && (major > 1 || (major == 1 && minor >= 5))) {
+        od->randr = 1;
+        XRRSelectInput(od->display, RootWindow(od->display, od->screen),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+    } else {
+        fprintf(stderr, "Warning: RandR 1.5 not available. Using one overlay for the whole screen.\n");
+    }
+    overlay_display_load_monitors(od);
+}
+
+// Apply one event read from the render connection. Returns 1 if the
+// monitor layout changed: every overlay set then needs overlays_update.
+int overlay_display_event(OverlayDisplay *od, XEvent *ev) {
+    if (!od->randr || (ev->type != od->randr_event_base + RRScreenChangeNotify &&
+                       ev->type != od->randr_event_base + RRNotify)) return 0;
+    overlay_display_load_monitors(od);
+    return 1;
+}
+
+// No window is created yet, and nothing is asked of the server
+void overlays_init(OverlaySet *set, OverlayDisplay *od, const RenderBackend *backend) {
+    memset(set, 0, sizeof(*set));
+    set->display = od;
+    set->backend = backend;
+    set->current = -1;
+}
+
+void overlays_destroy(OverlaySet *set) {
+    for (int i = 0; i < set->count; ++i) {
+        if (set->overlays[i].window) overlay_destroy(&set->overlays[i]);
+    }
+    set->count = 0;
+}
+
+// The monitor layout changed: move existing overlays to their monitor's new
+// geometry, drop those whose monitor is gone. Monitors are matched by name
+// (by geometry when RandR isn't there to name them).
+void overlays_update(OverlaySet *set) {
+    const Monitor *monitors = set->display->monitors;
+    Overlay overlays[OVERLAY_MAX_MONITORS];
+    int count = set->display->count;
+
+    memset(overlays, 0, sizeof(overlays));
+    for (int i = 0; i < set->count; ++i) {
+        Overlay *overlay = &set->overlays[i];
+        if (!overlay->window) continue;
+
+        const Monitor *old = &set->monitors[i];
+        int j = 0;
+        for (; j < count; ++j) {
+            const Monitor *m = &monitors[j];
+            if (overlays[j].window) continue;
+            if (old->name != None ? m->name == old->name :
+                (m->x == old->x && m->y == old->y && m->width == old->width && m->height == old->height)) break;
+        }
+        if (j == count) { // Monitor unplugged or turned off
+            overlay_destroy(overlay);
+            continue;
+        }
+        overlays[j] = *overlay;
+        const Monitor *m = &monitors[j];
+        if (m->x != old->x || m->y != old->y || m->width != old->width || m->height != old->height) {
+            if (overlay_resize(&overlays[j], m) != 0) {
+                fprintf(stderr, "Warning: Could not resize the overlay for monitor %d.\n", j);
+            }
+        }
+    }
+
+    memcpy(set->monitors, monitors, sizeof(set->monitors));
+    memcpy(set->overlays, overlays, sizeof(overlays));
+    set->count = count;
+    set->current = -1;
+}
+
+// Make sure the monitor under (x, y) has an overlay. Cheap while the
+// pointer stays on the same monitor. The set's first sample also fetches
+// the monitor layout.
+void overlays_track(OverlaySet *set, int x, int y) {
+    if (set->current >= 0 && monitor_contains(&set->monitors[set->current], x, y)) return;
+    if (set->count == 0) {
+        overlay_display_query(set->display);
+        memcpy(set->monitors, set->display->monitors, sizeof(set->monitors));
+        set->count = set->display->count;
+    }
+
+    for (int i = 0; i < set->count; ++i) {
+        if (!monitor_contains(&set->monitors[i], x, y)) continue;
+        set->current = i;
+        if (!set->overlays[i].window &&
+            overlay_create(&set->overlays[i], set->display, &set->monitors[i], set->backend) != 0) {
+            // Not retried until the pointer comes back to this monitor
+            fprintf(stderr, "Warning: Could not create an overlay for monitor %d.\n", i);
+        }
+        set->overlays[i].heatmap = set->heatmap;
+        return;
+    }
+}
+
+// Mark every overlay for redrawing after the trail changed
+void overlays_invalidate(OverlaySet *set) {
+    for (int i = 0; i < set->count; ++i) set->overlays[i].dirty = 1;
+}
+
+// Apply one event read from the overlay connection, after
+// overlay_display_event. Generic event data can only be fetched once, so
+// the caller has already done it for every set sharing the connection.
+void overlays_handle_event(OverlaySet *set, XEvent *ev, int layout_changed) {
+    if (layout_changed) {
+        if (set->count) overlays_update(set);
+        return;
+    }
+    for (int i = 0; i < set->count; ++i) {
+        Overlay *overlay = &set->overlays[i];
+        if (overlay->window) overlay->backend->event(overlay, ev);
+    }
+}
+
+// Redraw the overlays the trail changed on. An overlay whose backend can't
+// take a frame yet (Present frame in flight) stays dirty until it can.
+// Returns the number of frames drawn.
+int overlays_draw(OverlaySet *set, const Trail *trail) {
+    int frames = 0;
+    for (int i = 0; i < set->count; ++i) {
+        Overlay *overlay = &set->overlays[i];
+        if (!overlay->window || !overlay->dirty || !overlay->backend->ready(overlay)) continue;
+        overlay->backend->draw(overlay, trail);
+        overlay->dirty = 0;
+        frames++;
+    }
+    atomic_fetch_add_explicit(&stats.frames, frames, memory_order_relaxed);
+    return frames;
+}
+
+// When an overlay that is waiting to be redrawn can be drawn anyway, 0 if
+// none will be without an event
+uint64_t overlays_deadline(const OverlaySet *set) {
+    uint64_t deadline = 0;
+    for (int i = 0; i < set->count; ++i) {
+        const Overlay *overlay = &set->overlays[i];
+        if (!overlay->window || !overlay->dirty || !overlay->backend->deadline) continue;
+        deadline = deadline_min(deadline, overlay->backend->deadline(overlay));
+    }
+    return deadline;
+}
+
+// --- Seats (one per display) ---
+
+// Open the seat's ring and X connections: one for rendering and one for the
+// capture thread, or a single one that capture owns when headless. A
+// headless replay opens none. Returns 0 on success, -1 on error; either way
+// seats_close cleans up.
+int seat_connect(Seat *seat, int index, int mode, int all_pointers, TraceReader *replay) {
+    CaptureContext *ctx = &seat->capture;
+
+    ctx->stop_fd = -1;
+    if (ring_init(&seat->ring) != 0 || (ctx->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    ctx->seat = index;
+    ctx->ring = &seat->ring;
+
+    if (seat->overlay || mode != CAPTURE_REPLAY) {
+        seat->display = XOpenDisplay(seat->name);
+        if (!seat->display) {
+            fprintf(stderr, "Error: Could not open X display %s\n", XDisplayName(seat->name));
+            return -1;
+        }
+        seat->screen = DefaultScreen(seat->display);
+        ctx->width = DisplayWidth(seat->display, seat->screen);
+        ctx->height = DisplayHeight(seat->display, seat->screen);
+        if (seat->overlay && overlay_display_init(&seat->overlay_display, seat->display, seat->screen) != 0) return -1;
+    } else {
+        ctx->width = replay->header->screen_width;
+        ctx->height = replay->header->screen_height;
+    }
+    if (mode == CAPTURE_REPLAY) {
+        ctx->mode = mode;
+        ctx->replay = replay;
+        return 0;
+    }
+#ifdef HAVE_XCB
+    if (ctx->use_xcb) return xcb_capture_init(ctx, seat->name, mode, all_pointers);
+#endif
+
+    // With an overlay, capture gets its own connection so the two threads
+    // never share Xlib state
+    ctx->display = seat->overlay ? XOpenDisplay(seat->name) : seat->display;
+    if (!ctx->display) {
+        fprintf(stderr, "Error: Could not open X display %s for capture\n", XDisplayName(seat->name));
+        return -1;
+    }
+    ctx->root_window = RootWindow(ctx->display, DefaultScreen(ctx->display));
+
+    // --- Setup XInput2 Capture ---
+    if (mode == CAPTURE_XI2 && xi2_init(ctx->display, ctx->root_window, &ctx->xi, 1, all_pointers) != 0) {
+        fprintf(stderr, "Warning: Falling back to XQueryPointer polling.\n");
+        mode = CAPTURE_POLL;
+    }
+    if (mode == CAPTURE_POLL && all_pointers &&
+        xi2_init(ctx->display, ctx->root_window, &ctx->xi, 0, all_pointers) != 0) {
+        fprintf(stderr, "Warning: Following the core pointer only.\n");
+    }
+    ctx->mode = mode;
+    return 0;
+}
+
+// Render-side state of pointer 'index', set up when its first sample
+// arrives. Returns NULL if it can't be followed.
+TrackedPointer *seat_pointer(Seat *seat, unsigned int index) {
+    if (index >= POINTER_MAX) return NULL;
+    TrackedPointer *p = &seat->pointers[index];
+    if (p->active) return p;
+
+    if (trail_init(&p->trail, seat->trail_length) != 0) {
+        fprintf(stderr, "Error: Could not allocate a trail of %u points\n", seat->trail_length);
+        return NULL;
+    }
+    p->trail.interpolate = seat->interpolate;
+    p->predict.model = seat->predict;
+    p->active = 1;
+    stats.motion[seat->capture.seat][index] = &p->motion;
+    // Windows are created per monitor as the pointer reaches it
+    if (seat->overlay) {
+        overlays_init(&p->overlays, &seat->overlay_display, seat->backend);
+        p->overlay = 1;
+    }
+    return p;
+}
+
+// Read whatever the server sent on the seat's render connection and hand
+// it to every pointer's overlays
+void seat_handle_events(Seat *seat) {
+    while (XPending(seat->display)) {
+        XEvent ev;
+        XNextEvent(seat->display, &ev);
+        XRRUpdateConfiguration(&ev); // Keeps Xlib's screen size current; ignores other events
+
+        int have_data = ev.type == GenericEvent && XGetEventData(seat->display, &ev.xcookie);
+        int layout_changed = overlay_display_event(&seat->overlay_display, &ev);
+        for (int i = 0; i < POINTER_MAX; ++i) {
+            if (seat->pointers[i].overlay) overlays_handle_event(&seat->pointers[i].overlays, &ev, layout_changed);
+        }
+        if (seat->heat_overlay) overlays_handle_event(&seat->heat_overlays, &ev, layout_changed);
+        if (have_data) XFreeEventData(seat->display, &ev.xcookie);
+    }
+}
+
+// Redraw the trails that changed, unless they have faded into a single
+// resting dot that is already on screen, or the last frame is still waiting
+// for its vblank
+void seat_draw(Seat *seat) {
+    uint64_t now = seat->predict ? now_ns(CLOCK_MONOTONIC) : 0;
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        TrackedPointer *p = &seat->pointers[i];
+        if (p->overlay && seat->predict) p->redraw |= trail_predict(&p->trail, &p->predict, now);
+        if (p->overlay && p->redraw) overlays_invalidate(&p->overlays);
+    }
+    if (seat->heat_overlay && heatmap_update(&seat->heatmap)) overlays_invalidate(&seat->heat_overlays);
+    seat_handle_events(seat);
+    if (seat->heat_overlay && seat->heatmap.ndirty) {
+        overlays_draw(&seat->heat_overlays, NULL);
+        heatmap_drawn(&seat->heatmap);
+    }
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        TrackedPointer *p = &seat->pointers[i];
+        if (p->overlay && overlays_draw(&p->overlays, &p->trail) && p->undrawn_ns) {
+            uint64_t drawn = now_ns(CLOCK_MONOTONIC);
+            hist_record(&stats.lag, drawn - p->undrawn_ns);
+            if (!stats.first_frame_ns) stats.first_frame_ns = drawn;
+            p->undrawn_ns = 0;
+        }
+        p->redraw = 0;
+    }
+}
+
+// Count every seat's samples into a heatmap of 'cell' pixel cells, drawn
+// below the trails when the seat has overlays. Returns 0 on success, -1 on
+// error.
+int seats_heatmap_init(Seat *seats, int count, int cell) {
+    for (int s = 0; s < count; ++s) {
+        Seat *seat = &seats[s];
+        if (heatmap_init(&seat->heatmap, seat->capture.width, seat->capture.height, cell) != 0) return -1;
+        seat->heat = 1;
+        if (seat->overlay) {
+            overlays_init(&seat->heat_overlays, &seat->overlay_display, &heatmap_backend);
+            seat->heat_overlays.heatmap = &seat->heatmap;
+            seat->heat_overlay = 1;
+        }
+    }
+    return 0;
+}
+
+// Write each seat's heatmap to 'path'. With several seats, -1, -2... go
+// before the extension. Returns 0 on success, -1 if any failed.
+int seats_write_heatmaps(Seat *seats, int count, const char *path) {
+    int result = 0;
+    for (int s = 0; s < count; ++s) {
+        char numbered[PATH_MAX];
+        const char *out = path;
+        if (count > 1) {
+            const char *dot = strrchr(path, '.');
+            int stem = dot && !strchr(dot, '/') ? (int)(dot - path) : (int)strlen(path);
+            snprintf(numbered, sizeof(numbered), "%.*s-%d%s", stem, path, s + 1, path + stem);
+            out = numbered;
+        }
+        if (heatmap_write_png(&seats[s].heatmap, out) != 0) result = -1;
+    }
+    return result;
+}
+
+// When a trail's predicted head has to be taken back because its pointer
+// stopped, unless another sample comes first (0: no head shown)
+uint64_t seat_predict_deadline(const Seat *seat) {
+    uint64_t deadline = 0;
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        const TrackedPointer *p = &seat->pointers[i];
+        if (!p->trail.lead) continue;
+        uint64_t due = predict_deadline(&p->predict);
+        if (!deadline || due < deadline) deadline = due;
+    }
+    return deadline;
+}
+
+// When a frame held back by its backend is drawn anyway (see overlays_deadline)
+uint64_t seat_frame_deadline(const Seat *seat) {
+    uint64_t deadline = seat->heat_overlay ? overlays_deadline(&seat->heat_overlays) : 0;
+    for (int i = 0; i < POINTER_MAX; ++i) {
+        const TrackedPointer *p = &seat->pointers[i];
+        if (p->overlay) deadline = deadline_min(deadline, overlays_deadline(&p->overlays));
+    }
+    return deadline;
+}
+
+// Free everything seat_connect, seat_pointer and seats_heatmap_init set up, for the first
+// 'count' seats. Capture threads must have been stopped.
+void seats_close(Seat *seats, int count) {
+    for (int s = 0; s < count; ++s) {
+        Seat *seat = &seats[s];
+        CaptureContext *ctx = &seat->capture;
+        for (int i = 0; i < POINTER_MAX; ++i) {
+            TrackedPointer *p = &seat->pointers[i];
+            stats.motion[s][i] = NULL;
+            if (p->overlay) overlays_destroy(&p->overlays);
+            if (p->active) trail_free(&p->trail);
+        }
+        if (seat->heat_overlay) overlays_destroy(&seat->heat_overlays);
+        if (seat->heat) heatmap_free(&seat->heatmap);
+        if (seat->windows.display) window_cache_free(&seat->windows);
+        if (ctx->display && ctx->display != seat->display) XCloseDisplay(ctx->display);
+#ifdef HAVE_XCB
+        if (ctx->conn) xcb_disconnect(ctx->conn);
+#endif
+        if (seat->display) XCloseDisplay(seat->display);
+        if (ctx->stop_fd >= 0) close(ctx->stop_fd);
+        if (seat->ring.wake_fd >= 0) close(seat->ring.wake_fd);
+    }
+}
+
+// --- Event Loop ---
+
+int loop_add(EventLoop *loop, int fd, int type, int index) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EVENT_TAG(type, index) };
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void loop_close(EventLoop *loop) {
+    if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+    if (loop->signal_fd >= 0) close(loop->signal_fd);
+    if (loop->timer_fd >= 0) close(loop->timer_fd);
+}
+
+// Create the epoll set with its signalfd for 'signals' (which must be
+// blocked in every thread) and timerfd. Returns 0 on success, -1 on error.
+int loop_init(EventLoop *loop, const sigset_t *signals) {
+    loop->timer_deadline = 0;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->signal_fd < 0 || loop->timer_fd < 0 ||
+        loop_add(loop, loop->signal_fd, EVENT_SIGNAL, 0) != 0 ||
+        loop_add(loop, loop->timer_fd, EVENT_TIMER, 0) != 0) {
+        perror("event loop");
+        loop_close(loop);
+        return -1;
+    }
+    return 0;
+}
+
+// Arm the timer for an absolute CLOCK_MONOTONIC deadline (0: disarm). Only
+// costs a syscall when the deadline changes, about once per log batch.
+void loop_arm(EventLoop *loop, uint64_t deadline) {
+    if (deadline == loop->timer_deadline) return;
+    struct itimerspec spec = { { 0, 0 }, { (time_t)(deadline / 1000000000ull),
+                                           (long)(deadline % 1000000000ull) } };
+    if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) perror("timerfd_settime");
+    loop->timer_deadline = deadline;
+}
+
+// Sleep until there is work: samples on any seat's ring, or any other fd in
+// the set becoming readable. Uses the rings' consumer_waiting handshake (see
+// ring_wait), so producers only write their eventfd while we really sleep,
+// and nothing is slept on if samples are already queued.
+// Returns the number of events stored in events[] (0 if it didn't sleep).
+int loop_wait(EventLoop *loop, Seat *seats, int nseats, struct epoll_event *events, int max) {
+    int queued = 0, n = 0;
+
+    for (int s = 0; s < nseats; ++s) {
+        atomic_store_explicit(&seats[s].ring.consumer_waiting, 1, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int s = 0; s < nseats && !queued; ++s) {
+        SampleRing *ring = &seats[s].ring;
+        queued = atomic_load_explicit(&ring->head, memory_order_acquire) !=
+                 atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+    if (!queued && (n = epoll_wait(loop->epoll_fd, events, max, -1)) < 0) {
+        if (errno != EINTR) perror("epoll_wait");
+        n = 0;
+    }
+    for (int s = 0; s < nseats; ++s) {
+        atomic_store_explicit(&seats[s].ring.consumer_waiting, 0, memory_order_relaxed);
+    }
+
+    // Reset the eventfds that woke us; the samples are taken at the top of the loop
+    for (int i = 0; i < n; ++i) {
+        if (EVENT_TYPE(events[i].data.u64) != EVENT_RING) continue;
+        uint64_t count;
+        if (read(seats[EVENT_INDEX(events[i].data.u64)].ring.wake_fd, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN) {
+            perror("read(eventfd)");
+        }
+    }
+    return n;
+}
+
+void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -x, --xi2         Capture with XInput2 raw events instead of polling\n"
+#ifdef HAVE_XCB
+           "  -X, --xcb         Capture over XCB, keeping pointer queries in flight\n"
+#endif
+           "  -n, --no-overlay  Log coordinates only; no window, no compositor needed\n"
+           "  -d, --display NAME\n"
+           "                    X display to follow (default $DISPLAY); repeat for up to %d\n"
+           "  -a, --all-pointers\n"
+           "                    Follow every XInput2 master pointer (MPX), each with its own trail\n"
+           "  -t, --trail N     Number of points in the trail (default 50)\n"
+           "  -g, --renderer NAME\n"
+           "                    Overlay renderer: cairo, xshm"
+#ifdef HAVE_EGL
+           " or egl"
+#endif
+           " (default cairo)\n"
+           "  -I, --interpolate Fill the gaps between trail points in fast moves\n"
+           "  -e, --predict MODEL\n"
+           "                    Draw the trail head where the pointer will be when the\n"
+           "                    frame is shown: linear or kalman\n"
+           "  -r, --record FILE Record every sample to a binary trace file\n"
+           "  -P, --packed      Record a delta-encoded trace, about 4x smaller\n"
+           "  -T, --trigger LIST\n"
+           "                    Record only around triggers: click, jump[=PX] (default %d)\n"
+           "                    and signal (SIGUSR2), comma-separated\n"
+           "  -B, --pre-roll S  Seconds kept in memory and recorded before a trigger\n"
+           "                    (default %.0f)\n"
+           "  -A, --post-roll S Seconds recorded after the latest trigger (default %.0f)\n"
+           "  -m, --shm NAME    Publish live samples to POSIX shared memory /NAME\n"
+           "  -N, --send URL    Stream samples to tcp://HOST:PORT or udp://HOST:PORT\n"
+           "  -z, --compress CODEC\n"
+           "                    Compress --send frames: none"
+#ifdef HAVE_LZ4
+           ", lz4"
+#endif
+#ifdef HAVE_ZSTD
+           ", zstd"
+#endif
+           " (default none)\n"
+           "  -H, --heatmap CELL\n"
+           "                    Draw a heatmap of moves and clicks below the trail,\n"
+           "                    in CELL x CELL pixel cells (default %d)\n"
+           "  -o, --heatmap-png FILE\n"
+           "                    Write the heatmap to a PNG on exit and on SIGUSR1\n"
+           "  -p, --replay FILE Play back a recorded trace instead of capturing\n"
+           "  -S, --speed N     Replay at N times real time; 0 = as fast as possible\n"
+           "                    (default 1)\n"
+           "  -R, --rate HZ     Polling rate while the pointer is active (default 60)\n"
+           "  -i, --idle-rate HZ\n"
+           "                    Back off to this rate while idle (default: same as --rate)\n"
+           "  -w, --windows     Tag each sample with the window's WM_CLASS and title\n"
+           "  -l, --log FORMAT  Stdout format: status, csv or json\n"
+           "                    (default: status on a terminal, csv otherwise)\n"
+           "  -s, --stats-socket PATH\n"
+           "                    Serve latency/throughput stats on a Unix socket\n"
+           "                    (also printed to stderr on SIGUSR1)\n"
+           "  -h, --help        Show this help\n", prog, SEAT_MAX, TRIGGER_JUMP_PX, TRIGGER_PRE_ROLL,
+           TRIGGER_POST_ROLL, HEATMAP_CELL);
+}
+
+#ifndef CURTKR_NO_MAIN // Defined by bench/bench.c, which includes this file
+int main(int argc, char *argv[]) {
+    stats.start_ns = now_ns(CLOCK_MONOTONIC);
+    int use_overlay = 1;
+
+    // Displays followed, each with its capture thread and queue
+    Seat *seats;
+    const char *display_names[SEAT_MAX];
+    int nseats = 0, nconnected = 0;
+    int all_pointers = 0;
+    int capture_mode = CAPTURE_POLL;
+#ifdef HAVE_XCB
+    int use_xcb = 0;
+#endif
+    static TraceWriter trace;
+    const char *record_path = NULL;
+    int record_packed = 0;
+    static TriggerRecorder trigger;
+    const char *trigger_spec = NULL;
+    double pre_roll = -1, post_roll = -1; // -1: default, only valid with a trigger
+    static TraceReader replay;
+    const char *replay_path = NULL;
+    double replay_speed = 1;
+    static ShmPublisher shm;
+    const char *shm_name = NULL;
+    static NetSink net;
+    const char *send_url = NULL;
+    int send_codec = NET_CODEC_NONE;
+    int heatmap_cell = 0; // 0: no heatmap
+    const char *heatmap_png = NULL;
+    unsigned int trail_length = TRAIL_LENGTH;
+    int interpolate = 0;
+    int predict = PREDICT_NONE;
+    const RenderBackend *renderer = &cairo_backend;
+    static StatsServer stats_server;
+    const char *stats_path = NULL;
+    static Logger logger;
+    static WindowCache *window_caches[SEAT_MAX];
+    int use_windows = 0;
+    int log_format = -1;
+    double rate_hz = 1000000.0 / UPDATE_INTERVAL;
+    double idle_rate_hz = 0; // 0: same as rate_hz
+    FILE *info = stdout; // Human-readable messages; stderr when stdout carries data
+
+    // --- Parse Options ---
+    static const struct option long_options[] = {
+        { "xi2",        no_argument, NULL, 'x' },
+        { "xcb",        no_argument, NULL, 'X' },
+        { "no-overlay", no_argument, NULL, 'n' },
+        { "display",    required_argument, NULL, 'd' },
+        { "all-pointers", no_argument, NULL, 'a' },
+        { "trail",      required_argument, NULL, 't' },
+        { "renderer",   required_argument, NULL, 'g' },
+        { "interpolate", no_argument, NULL, 'I' },
+        { "predict",    required_argument, NULL, 'e' },
+        { "record",     required_argument, NULL, 'r' },
+        { "packed",     no_argument, NULL, 'P' },
+        { "trigger",    required_argument, NULL, 'T' },
+        { "pre-roll",   required_argument, NULL, 'B' },
+        { "post-roll",  required_argument, NULL, 'A' },
+        { "replay",     required_argument, NULL, 'p' },
+        { "shm",        required_argument, NULL, 'm' },
+        { "send",       required_argument, NULL, 'N' },
+        { "compress",   required_argument, NULL, 'z' },
+        { "heatmap",    required_argument, NULL, 'H' },
+        { "heatmap-png", required_argument, NULL, 'o' },
+        { "speed",      required_argument, NULL, 'S' },
+        { "log",        required_argument, NULL, 'l' },
+        { "windows",    no_argument, NULL, 'w' },
+        { "rate",       required_argument, NULL, 'R' },
+        { "idle-rate",  required_argument, NULL, 'i' },
+        { "stats-socket", required_argument, NULL, 's' },
+        { "help",       no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "xXnd:at:g:Ie:r:PT:B:A:p:S:m:N:z:H:o:l:wR:i:s:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'x': capture_mode = CAPTURE_XI2; break;
+        case 'X':
+#ifdef HAVE_XCB
+            use_xcb = 1;
+            break;
+#else
+            fprintf(stderr, "Error: Built without XCB (make HAVE_XCB=1)\n");
+            return 1;
+#endif
+        case 'n': use_overlay = 0; break;
+        case 'd':
+            if (nseats == SEAT_MAX) { fprintf(stderr, "Error: At most %d displays\n", SEAT_MAX); return 1; }
+            display_names[nseats++] = optarg;
+            break;
+        case 'a': all_pointers = 1; break;
+        case 't': {
+            long n = atol(optarg);
+            if (n < 1 || n > TRAIL_LENGTH_MAX) {
+                fprintf(stderr, "Error: Trail length must be 1-%d\n", TRAIL_LENGTH_MAX); return 1;
+            }
+            trail_length = (unsigned int)n;
+            break;
+        }
+        case 'g':
+            renderer = render_backend_find(optarg);
+            if (!renderer) { fprintf(stderr, "Error: Unknown renderer '%s'\n", optarg); return 1; }
+            break;
+        case 'I': interpolate = 1; break;
+        case 'e':
+            if (strcmp(optarg, "linear") == 0) predict = PREDICT_LINEAR;
+            else if (strcmp(optarg, "kalman") == 0) predict = PREDICT_KALMAN;
+            else { fprintf(stderr, "Error: Unknown prediction model '%s'\n", optarg); return 1; }
+            break;
+        case 'r': record_path = optarg; break;
+        case 'P': record_packed = 1; break;
+        case 'T':
+            trigger_spec = optarg;
+            if (trigger_parse(&trigger, optarg) != 0) return 1;
+            break;
+        case 'B':
+        case 'A': {
+            char *end;
+            double seconds = strtod(optarg, &end);
+            if (*end || seconds < 0 || seconds > 3600) {
+                fprintf(stderr, "Error: Invalid %s '%s'\n", opt == 'B' ? "pre-roll" : "post-roll", optarg); return 1;
+            }
+            if (opt == 'B') pre_roll = seconds; else post_roll = seconds;
+            break;
+        }
+        case 'p': replay_path = optarg; break;
+        case 'm': shm_name = optarg; break;
+        case 'N': send_url = optarg; break;
+        case 'z':
+            if (strcmp(optarg, "none") == 0) send_codec = NET_CODEC_NONE;
+#ifdef HAVE_LZ4
+            else if (strcmp(optarg, "lz4") == 0) send_codec = NET_CODEC_LZ4;
+#endif
+#ifdef HAVE_ZSTD
+            else if (strcmp(optarg, "zstd") == 0) send_codec = NET_CODEC_ZSTD;
+#endif
+            else { fprintf(stderr, "Error: Unknown or unsupported codec '%s'\n", optarg); return 1; }
+            break;
+        case 'H': {
+            long n = atol(optarg);
+            if (n < 1 || n > 256) { fprintf(stderr, "Error: Heatmap cell must be 1-256 pixels\n"); return 1; }
+            heatmap_cell = (int)n;
+            break;
+        }
+        case 'o': heatmap_png = optarg; break;
+        case 'w': use_windows = 1; break;
+        case 'S': {
+            char *end;
+            replay_speed = strtod(optarg, &end);
+            if (*end || replay_speed < 0) { fprintf(stderr, "Error: Invalid speed '%s'\n", optarg); return 1; }
+            break;
+        }
+        case 's': stats_path = optarg; break;
+        case 'R':
+        case 'i': {
+            double hz = atof(optarg);
+            if (hz <= 0 || hz > 100000) { fprintf(stderr, "Error: Invalid rate '%s'\n", optarg); return 1; }
+            if (opt == 'R') rate_hz = hz; else idle_rate_hz = hz;
+            break;
+        }
+        case 'l':
+            if (strcmp(optarg, "status") == 0) log_format = LOG_STATUS;
+            else if (strcmp(optarg, "csv") == 0) log_format = LOG_CSV;
+            else if (strcmp(optarg, "json") == 0) log_format = LOG_JSON;
+            else { fprintf(stderr, "Error: Unknown log format '%s'\n", optarg); return 1; }
+            break;
+        case 'h': usage(argv[0]); return 0;
+        default:  usage(argv[0]); return 1;
+        }
+    }
+    if (nseats == 0) display_names[nseats++] = NULL; // $DISPLAY
+    if (record_packed && !record_path) {
+        fprintf(stderr, "Error: --packed needs --record\n");
+        return 1;
+    }
+    if (trigger_spec && !record_path) {
+        fprintf(stderr, "Error: --trigger needs --record\n");
+        return 1;
+    }
+    if ((pre_roll >= 0 || post_roll >= 0) && !trigger_spec) {
+        fprintf(stderr, "Error: --pre-roll and --post-roll need --trigger\n");
+        return 1;
+    }
+    if (heatmap_png && !heatmap_cell) heatmap_cell = HEATMAP_CELL;
+    if (heatmap_cell && !use_overlay && !heatmap_png) {
+        fprintf(stderr, "Error: --heatmap with --no-overlay needs --heatmap-png\n");
+        return 1;
+    }
+    if (nseats > 1 && (record_path || replay_path || shm_name)) {
+        fprintf(stderr, "Error: --record, --replay and --shm follow a single display\n");
+        return 1;
+    }
+
+    // --- Setup Logger ---
+    // Pipes and files get clean line-oriented output for analysis jobs
+    if (log_format < 0) log_format = isatty(STDOUT_FILENO) ? LOG_STATUS : LOG_CSV;
+    if (log_format != LOG_STATUS) info = stderr;
+    logger_init(&logger, STDOUT_FILENO, log_format);
+    logger.sources = nseats > 1 || all_pointers;
+    signal(SIGPIPE, SIG_IGN); // A closed pipe shows up as EPIPE from write instead
+
+    // --- Allocate Seats ---
+    // Rings, window caches and per-pointer overlay sets make these large,
+    // but pages a seat never touches are never faulted in
+    seats = calloc((size_t)nseats, sizeof(Seat));
+    if (!seats) {
+        fprintf(stderr, "Error: Could not allocate %d displays\n", nseats);
+        return 1;
+    }
+    for (int s = 0; s < nseats; ++s) {
+        seats[s].name = display_names[s];
+        seats[s].overlay = use_overlay;
+        seats[s].backend = renderer;
+        seats[s].trail_length = trail_length;
+        seats[s].interpolate = interpolate;
+        seats[s].predict = use_overlay ? predict : PREDICT_NONE;
+    }
+
+    // --- Block Signals ---
+    // SIGINT, SIGTERM and SIGUSR1 (and SIGUSR2 for --trigger signal) are
+    // never delivered asynchronously: they stay blocked in every thread
+    // (capture threads inherit the mask) and the render loop reads them from
+    // a signalfd. One that arrives during setup waits there until the loop
+    // starts.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    if (trigger.triggers & TRIGGER_SIGNAL) sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // --- Open Stats Endpoint ---
+    if (stats_path && stats_server_open(&stats_server, stats_path) != 0) {
+        return 1;
+    }
+
+    // --- Start Network Sink ---
+    // After blocking signals: the sender thread inherits the mask
+    if (send_url) {
+        if (net_open(&net, send_url, send_codec) != 0) {
+            if (stats_path) stats_server_close(&stats_server);
+            return 1;
+        }
+        fprintf(info, "Streaming samples to %s\n", send_url);
+    }
+
+    // --- Open Replay Source ---
+    if (replay_path) {
+        if (trace_reader_open(&replay, replay_path) != 0) return 1;
+        capture_mode = CAPTURE_REPLAY;
+    }
+
+    // --- Connect to the X Servers ---
+    for (int s = 0; s < nseats; ++s) {
+        Seat *seat = &seats[s];
+        nconnected++;
+#ifdef HAVE_XCB
+        seat->capture.use_xcb = use_xcb;
+#endif
+        if (seat_connect(seat, s, capture_mode, all_pointers, &replay) != 0) {
+            seats_close(seats, nconnected);
+            return 1;
+        }
+        if (idle_rate_hz <= 0 || idle_rate_hz > rate_hz) idle_rate_hz = rate_hz;
+        seat->capture.replay_speed = replay_speed;
+        seat->capture.fast_interval = (long)(1000000.0 / rate_hz);
+        seat->capture.idle_interval = (long)(1000000.0 / idle_rate_hz);
+    }
+    CaptureContext *capture = &seats[0].capture; // The only one with --record/--replay/--shm
+
+    // --- Setup Window Attribution ---
+    // All displays or none, so every line has the same columns
+    if (use_windows) {
+        int s = 0;
+        while (s < nseats && window_cache_init(&seats[s].windows, seats[s].name, log_format) == 0) {
+            window_caches[s] = &seats[s].windows;
+            s++;
+        }
+        if (s == nseats) {
+            logger.windows = window_caches;
+        } else {
+            fprintf(stderr, "Warning: Logging without window attribution.\n");
+            while (s-- > 0) window_cache_free(&seats[s].windows);
+        }
+    }
+
+    // --- Open Trace File ---
+    if (record_path) {
+        if (trace_open(&trace, record_path, capture->width, capture->height, record_packed) != 0) {
+            seats_close(seats, nconnected);
+            return 1;
+        }
+        capture->trace = &trace;
+        if (trigger_spec) {
+            if (pre_roll < 0) pre_roll = TRIGGER_PRE_ROLL;
+            if (post_roll < 0) post_roll = TRIGGER_POST_ROLL;
+            if (trigger_init(&trigger, pre_roll, post_roll) != 0) {
+                trace_close(&trace);
+                seats_close(seats, nconnected);
+                return 1;
+            }
+            capture->trigger = &trigger;
+        }
+        fprintf(info, "Recording to %s%s", record_path, record_packed ? " (packed)" : "");
+        if (trigger_spec) fprintf(info, ", %.1fs around each %s", pre_roll + post_roll, trigger_spec);
+        fputc('\n', info);
+    }
+
+    // --- Open Shared-Memory Ring ---
+    if (shm_name) {
+        if (shm_open_publisher(&shm, shm_name, capture->width, capture->height) != 0) {
+            seats_close(seats, nconnected);
+            if (record_path) trace_close(&trace);
+            trigger_free(&trigger);
+            return 1;
+        }
+        capture->shm = &shm;
+        fprintf(info, "Publishing samples to shared memory %s\n", shm_name);
+    }
+
+    // --- Create Overlay ---
+    // Pointer 0 of every display is set up now, so a missing compositor is
+    // reported before anything starts; other pointers on first use
+    for (int s = 0; s < nseats; ++s) {
+        TrackedPointer *p = seat_pointer(&seats[s], 0);
+        if (!p || (use_overlay && !p->overlay)) {
+            seats_close(seats, nconnected);
+            if (record_path) trace_close(&trace);
+            trigger_free(&trigger);
+            if (shm_name) shm_close_publisher(&shm);
+            return 1;
+        }
+    }
+
+    // --- Setup Heatmap ---
+    // Its overlays are stacked below the trails': each monitor's heatmap
+    // window is created just before the trail window there
+    if (heatmap_cell && seats_heatmap_init(seats, nseats, heatmap_cell) != 0) {
+        seats_close(seats, nconnected);
+        if (record_path) trace_close(&trace);
+        trigger_free(&trigger);
+        if (shm_name) shm_close_publisher(&shm);
+        return 1;
+    }
+
+    if (use_overlay) {
+        fprintf(info, "Mouse trail overlay started. Press Ctrl+C to exit.\n");
+    } else {
+        fprintf(info, "Mouse tracker started (no overlay). Press Ctrl+C to exit.\n");
+    }
+    if (nseats > 1) fprintf(info, "Following %d displays\n", nseats);
+    if (replay_path) {
+        if (replay_speed > 0) fprintf(info, "Replaying %s at %gx speed\n", replay_path, replay_speed);
+        else fprintf(info, "Replaying %s as fast as possible\n", replay_path);
+    }
+    fflush(info);
+    logger_header(&logger);
+
+    // --- Setup Event Loop ---
+    // Wakes on samples, X events (with overlays), signals, the log flush
+    // timer and stats clients; nothing else ever wakes the render thread
+    static EventLoop loop;
+    int loop_failed = loop_init(&loop, &signals) != 0;
+    if (!loop_failed) {
+        for (int s = 0; s < nseats && !loop_failed; ++s) {
+            loop_failed = loop_add(&loop, seats[s].ring.wake_fd, EVENT_RING, s) != 0 ||
+                          (use_overlay && loop_add(&loop, ConnectionNumber(seats[s].display), EVENT_DISPLAY, s) != 0);
+        }
+        if (!loop_failed && stats_path) loop_failed = loop_add(&loop, stats_server.listen_fd, EVENT_STATS, 0) != 0;
+        if (loop_failed) {
+            perror("epoll_ctl");
+            loop_close(&loop);
+        }
+    }
+    if (loop_failed) {
+        seats_close(seats, nconnected);
+        if (record_path) trace_close(&trace);
+        trigger_free(&trigger);
+        if (shm_name) shm_close_publisher(&shm);
+        if (stats_path) stats_server_close(&stats_server);
+        return 1;
+    }
+
+    if (stats_path) fprintf(info, "Serving stats on %s\n", stats_path);
+
+    // --- Start Capture ---
+    for (int s = 0; s < nseats && keep_running; ++s) {
+        if (pthread_create(&seats[s].capture_tid, NULL, capture_thread, &seats[s].capture) == 0) {
+            seats[s].capture_started = 1;
+        } else {
+            fprintf(stderr, "Error: Could not start capture thread\n");
+            keep_running = 0;
+        }
+    }
+    stats.ready_ns = now_ns(CLOCK_MONOTONIC);
+
+    // --- Main Loop (render) ---
+    while (keep_running) {
+        // 1. Move everything captured so far into the trails and the log
+        unsigned long received = 0;
+        for (int s = 0; s < nseats; ++s) {
+            Seat *seat = &seats[s];
+            if (logger.windows) window_cache_handle_events(&seat->windows);
+            uint64_t arrived_ns = seat->predict ? now_ns(CLOCK_MONOTONIC) : 0;
+            Sample sample;
+            while (ring_pop(&seat->ring, &sample)) {
+                logger_sample(&logger, &sample);
+                if (send_url) net_sample(&net, &sample);
+                if (seat->heat) {
+                    heatmap_push(&seat->heatmap, &sample);
+                    if (seat->heat_overlay) overlays_track(&seat->heat_overlays, sample.x, sample.y);
+                }
+                TrackedPointer *p = seat_pointer(seat, sample.pointer);
+                if (p) {
+                    motion_push(&p->motion, &sample);
+                    if (seat->predict) predict_push(&p->predict, &sample, arrived_ns);
+                    p->redraw |= trail_push(&p->trail, &sample);
+                    if (p->overlay) overlays_track(&p->overlays, sample.x, sample.y);
+                    p->undrawn_ns = sample.time_ns;
+                }
+                received++;
+            }
+        }
+        if (received) {
+            if (!stats.first_sample_ns) stats.first_sample_ns = now_ns(CLOCK_MONOTONIC);
+            logger_batch_end(&logger);
+            if (send_url) net_batch_end(&net);
+            atomic_fetch_add_explicit(&stats.samples, received, memory_order_relaxed);
+        }
+
+        // 2. Draw and flush the new trails
+        for (int s = 0; s < nseats && use_overlay; ++s) seat_draw(&seats[s]);
+        if (received) continue;
+
+        // 3. Nothing queued: sleep until a capture thread has more, or
+        // something else in the loop needs handling. The timer fires when
+        // buffered log lines or a network frame are due, a predicted trail
+        // head has to be taken back, or a held-back frame times out.
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        uint64_t log_deadline = logger_deadline(&logger);
+        uint64_t net_due = send_url ? net_deadline(&net) : 0;
+        uint64_t predict_due = 0;
+        for (int s = 0; s < nseats && predict; ++s) {
+            predict_due = deadline_min(predict_due, seat_predict_deadline(&seats[s]));
+        }
+        for (int s = 0; s < nseats && use_overlay; ++s) {
+            predict_due = deadline_min(predict_due, seat_frame_deadline(&seats[s]));
+        }
+        if ((log_deadline && log_deadline <= now) || (net_due && net_due <= now) ||
+            (predict_due && predict_due <= now)) {
+            if (log_deadline && log_deadline <= now) logger_flush(&logger);
+            if (net_due && net_due <= now) net_flush(&net);
+            continue; // Predicted heads and timed-out frames are dealt with by seat_draw
+        }
+        loop_arm(&loop, deadline_min(deadline_min(log_deadline, net_due), predict_due));
+
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        int n = loop_wait(&loop, seats, nseats, events, LOOP_MAX_EVENTS);
+        for (int i = 0; i < n; ++i) {
+            switch (EVENT_TYPE(events[i].data.u64)) {
+            case EVENT_SIGNAL: {
+                struct signalfd_siginfo si;
+                while (read(loop.signal_fd, &si, sizeof(si)) == sizeof(si)) {
+                    if (si.ssi_signo == SIGUSR1) {
+                        if (log_format == LOG_STATUS) fputc('\n', stderr); // Off the status line
+                        stats_dump(STDERR_FILENO);
+                        if (heatmap_png && seats_write_heatmaps(seats, nseats, heatmap_png) == 0) {
+                            fprintf(stderr, "Heatmap written to %s\n", heatmap_png);
+                        }
+                    } else if (si.ssi_signo == SIGUSR2) {
+                        trigger_signal(&trigger);
+                    } else {
+                        fprintf(stderr, "\nCaught %s. Exiting gracefully...\n",
+                                si.ssi_signo == SIGINT ? "SIGINT" : "SIGTERM");
+                        keep_running = 0;
+                    }
+                }
+                break;
+            }
+            case EVENT_TIMER: {
+                uint64_t expirations;
+                if (read(loop.timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    perror("read(timerfd)");
+                }
+                if (logger_deadline(&logger) <= now_ns(CLOCK_MONOTONIC)) logger_flush(&logger);
+                if (send_url) net_batch_end(&net);
+                break;
+            }
+            case EVENT_STATS:
+                stats_server_serve(&stats_server);
+                break;
+            default:
+                break; // Rings and X connections are read at the top of the loop
+            }
+        }
+    } // End main loop
+
+    // --- Stop Capture ---
+    for (int s = 0; s < nseats; ++s) {
+        if (!seats[s].capture_started) continue;
+        uint64_t one = 1;
+        if (write(seats[s].capture.stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        pthread_join(seats[s].capture_tid, NULL);
+    }
+    if (stats_path) stats_server_close(&stats_server);
+    if (shm_name) shm_close_publisher(&shm);
+    // Drain what the capture threads queued before they stopped
+    for (int s = 0; s < nseats; ++s) {
+        Sample sample;
+        while (ring_pop(&seats[s].ring, &sample)) {
+            logger_sample(&logger, &sample);
+            if (send_url) net_sample(&net, &sample);
+            if (seats[s].heat) heatmap_push(&seats[s].heatmap, &sample);
+        }
+    }
+    logger_batch_end(&logger);
+    logger_flush(&logger);
+    if (send_url) net_close(&net);
+    if (heatmap_png && seats_write_heatmaps(seats, nseats, heatmap_png) == 0) {
+        fprintf(info, "\nHeatmap written to %s\n", heatmap_png);
+    }
+
+    unsigned long missed = atomic_load(&stats.missed_deadlines);
+    if (missed) {
+        fprintf(stderr, "Warning: %lu polling deadlines missed.\n", missed);
+    }
+    unsigned long dropped = atomic_load(&stats.dropped);
+    if (dropped) fprintf(stderr, "Warning: %lu samples dropped (render thread fell behind).\n", dropped);
+    unsigned long net_dropped = atomic_load(&stats.net_dropped);
+    if (net_dropped) fprintf(stderr, "Warning: %lu samples not sent to %s.\n", net_dropped, send_url);
+    if (record_path) {
+        trace_flush(&trace);
+        fprintf(info, "\nRecorded %llu samples to %s\n",
+               (unsigned long long)trace.header->record_count, record_path);
+        trace_close(&trace);
+        trigger_free(&trigger);
+    }
 
     // --- Cleanup ---
-    printf("\nCleaning up resources...\n");
-    if (cr) cairo_destroy(cr);
-    if (cairo_surface) cairo_surface_destroy(cairo_surface);
-    XFreeColormap(display, colormap);
-    XUnmapWindow(display, overlay_window);
-    XDestroyWindow(display, overlay_window);
-    XCloseDisplay(display);
+    fprintf(info, "\nCleaning up resources...\n");
+    seats_close(seats, nconnected);
+    free(seats);
+    loop_close(&loop);
+    if (replay_path) trace_reader_close(&replay);
 
-    printf("Exiting.\n");
+    fprintf(info, "Exiting.\n");
     return 0;
 }
+#endif // CURTKR_NO_MAIN